@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "evictor.h"
+#include "storage.h"
+
+extern vortex::journal_logger journal;
+
+vortex::evictor vortex::eviction;
+
+// entries evicted between checks for shutdown
+static const size_t evict_chunk = 256;
+
+vortex::evictor::~evictor() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    _cond.notify_one();
+    if(_thread.joinable()) _thread.join();
+}
+
+void vortex::evictor::start(size_t budget, eviction_policy policy, size_t samples) {
+    if(budget == 0) return;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if(_thread.joinable()) return;
+        _policy = policy;
+        _samples = samples > 0 ? samples : 5;
+        _budget = budget;
+        _thread = std::thread(&evictor::run, this);
+    }
+    cm_log::info(cm_util::format("eviction: budget %lu bytes, %s", budget,
+        policy == eviction_policy::lfu ? "lfu" : "lru"));
+
+    // the store may be over budget already after replay
+    check();
+}
+
+void vortex::evictor::wake() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if(!_wake) {
+        _wake = true;
+        _cond.notify_one();
+    }
+}
+
+void vortex::evictor::stats(eviction_stats &out) {
+    out.budget = _budget;
+    out.resident = mem_store->memory();
+    out.evicted = _evicted.exchange(0);
+    out.evicted_bytes = _evicted_bytes.exchange(0);
+}
+
+bool vortex::evictor::evict_one() {
+
+    // the guard covers choosing, removing and journaling the victim
+    vortex::mutation_guard guard;
+    shard_store *store = mem_store;
+    size_t shards = store->shards();
+
+    // shards in turn; an empty shard passes to the next
+    std::string victim;
+    size_t bytes = 0;
+    bool found = false;
+    for(size_t n = 0; n < shards && !found; n++) {
+        size_t index = _next_shard++ % shards;
+        found = store->evict_sample(index, _samples, _policy, victim, bytes);
+    }
+    if(!found) return false;
+
+    // queued without waiting for a sync: under -f batch, waiting would
+    // evict at fsync rate while writers run far past the budget
+    journal.post('-', victim, "-" + victim + "\n");
+
+    _evicted++;
+    _evicted_bytes += bytes;
+    return true;
+}
+
+void vortex::evictor::run() {
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            _cond.wait_for(guard, std::chrono::milliseconds(100), [this] { return _done || _wake; });
+            if(_done) return;
+            _wake = false;
+        }
+
+        // evict until back under budget, checking for shutdown now and then
+        bool more = true;
+        while(more) {
+            for(size_t n = 0; n < evict_chunk && more; n++) {
+                more = mem_store->memory() > _budget && evict_one();
+            }
+            std::lock_guard<std::mutex> guard(_mutex);
+            if(_done) return;
+        }
+    }
+}
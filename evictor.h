@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __EVICTOR_H
+#define __EVICTOR_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+#include "shard_store.h"
+
+namespace vortex {
+
+struct eviction_stats {
+    size_t budget;          // bytes; 0 when there is no limit
+    size_t resident;        // bytes held by the live store
+    uint64_t evicted;       // entries evicted since the last call
+    uint64_t evicted_bytes;
+};
+
+// keeps the live store within a byte budget. writers call check() after
+// growing the store; once it is over budget, a thread evicts entries
+// until it is back under. each victim is the worst of a few sampled
+// entries of a shard by the policy (approximate lru or lfu); it is removed
+// as it is chosen, then journaled as a delete without waiting for a sync,
+// so replay after a restart agrees with the store and peers drop it too.
+class evictor {
+
+protected:
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _thread;
+    bool _done = false;
+    bool _wake = false;
+
+    std::atomic<size_t> _budget;
+    eviction_policy _policy = eviction_policy::lru;
+    size_t _samples = 5;
+    size_t _next_shard = 0;
+
+    std::atomic<uint64_t> _evicted;
+    std::atomic<uint64_t> _evicted_bytes;
+
+    void run();
+
+    // evict one sampled entry; false if the store is empty
+    bool evict_one();
+
+public:
+    evictor(): _budget(0), _evicted(0), _evicted_bytes(0) {}
+    ~evictor();
+
+    // start evicting over budget bytes (0 = no limit)
+    void start(size_t budget, eviction_policy policy, size_t samples = 5);
+
+    // wake the evictor if the store is over budget
+    void check() {
+        if(_budget.load(std::memory_order_relaxed) == 0) return;
+        if(mem_store->memory() > _budget) wake();
+    }
+
+    void wake();
+
+    // counters since the last call, which resets them
+    void stats(eviction_stats &out);
+};
+
+extern evictor eviction;
+
+}
+
+#endif  // __EVICTOR_H
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+
+#include "expiry.h"
+#include "shard_store.h"
+
+vortex::expirer vortex::expiry;
+
+// wheel resolution
+static const uint64_t tick_ms = 100;
+
+void vortex::timer_wheel::place(timer &&t, uint64_t tick) {
+
+    // the lowest level whose span reaches the timer; beyond the top level
+    // it waits in the top level's furthest slot and is placed again
+    uint64_t delta = tick - _now;
+    int level = 0;
+    while(level < levels - 1 && delta >= ((uint64_t) 1 << (slot_bits * (level + 1)))) {
+        level++;
+    }
+    if(level == levels - 1 && delta >= ((uint64_t) 1 << (slot_bits * levels))) {
+        tick = _now + ((uint64_t) 1 << (slot_bits * levels)) - 1;
+    }
+
+    uint64_t slot = (tick >> (slot_bits * level)) & (slots - 1);
+    _wheel[level][slot].push_back(std::move(t));
+}
+
+void vortex::timer_wheel::add(timer &&t) {
+    // due timers go in the next tick's slot
+    uint64_t tick = (t.expires + _tick_ms - 1) / _tick_ms;
+    if(tick <= _now) tick = _now + 1;
+    place(std::move(t), tick);
+    _pending++;
+}
+
+void vortex::timer_wheel::advance(uint64_t now_ms, std::vector<timer> &out) {
+
+    uint64_t target = now_ms / _tick_ms;
+
+    while(_now < target) {
+        _now++;
+
+        // entering a new round of a level pulls the next slot of the
+        // level above down into the levels below
+        for(int level = 1; level < levels; level++) {
+            uint64_t below = (_now >> (slot_bits * (level - 1))) & (slots - 1);
+            if(below != 0) break;
+
+            uint64_t slot = (_now >> (slot_bits * level)) & (slots - 1);
+            std::vector<timer> cascade;
+            cascade.swap(_wheel[level][slot]);
+            for(auto &t : cascade) {
+                uint64_t tick = (t.expires + _tick_ms - 1) / _tick_ms;
+                place(std::move(t), tick > _now ? tick : _now);
+            }
+        }
+
+        std::vector<timer> &due = _wheel[0][_now & (slots - 1)];
+        _pending -= due.size();
+        for(auto &t : due) out.push_back(std::move(t));
+        due.clear();
+    }
+}
+
+vortex::expirer::expirer(): _wheel(tick_ms, expiry_clock()), _expired(0) {}
+
+vortex::expirer::~expirer() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    _cond.notify_one();
+    if(_thread.joinable()) _thread.join();
+}
+
+void vortex::expirer::start(bool (*expire)(const std::string &name, uint64_t expires)) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if(_thread.joinable()) return;
+    _expire = expire;
+    _thread = std::thread(&expirer::run, this);
+}
+
+void vortex::expirer::schedule(const std::string &name, uint64_t expires) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto it = _keys.find(name);
+    if(it == _keys.end()) {
+        _keys.emplace(name, key_timer{ expires, expires });
+        _wheel.add({ name, expires });
+        return;
+    }
+
+    it->second.due = expires;
+    if(expires < it->second.queued) {
+        it->second.queued = expires;
+        _wheel.add({ name, expires });
+    }
+}
+
+void vortex::expirer::stats(expiry_stats &out) {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        out.pending = _keys.size();
+    }
+    out.expired = _expired.exchange(0);
+}
+
+void vortex::expirer::run() {
+
+    std::vector<timer> fired;
+    std::vector<timer> due;
+
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            _cond.wait_for(guard, std::chrono::milliseconds(tick_ms), [this] { return _done; });
+            if(_done) return;
+            _wheel.advance(expiry_clock(), fired);
+
+            for(auto &t : fired) {
+                auto it = _keys.find(t.name);
+
+                // superseded by an earlier timer for the same key
+                if(it == _keys.end() || it->second.queued != t.expires) continue;
+
+                // written since with a later expiry; wait for that instead
+                if(it->second.due > t.expires) {
+                    it->second.queued = it->second.due;
+                    t.expires = it->second.due;
+                    _wheel.add(std::move(t));
+                    continue;
+                }
+
+                t.expires = it->second.due;
+                _keys.erase(it);
+                due.push_back(std::move(t));
+            }
+            fired.clear();
+        }
+
+        // outside the lock, so writers can schedule meanwhile
+        for(auto &t : due) {
+            if(_expire(t.name, t.expires)) _expired++;
+        }
+        due.clear();
+    }
+}
+
+bool vortex::parse_ttl(std::string &request, uint64_t &secs) {
+
+    if(request.empty() || request[0] != '+') return false;
+
+    size_t end = request.size();
+    if(request[end - 1] == '\n') end--;
+
+    size_t pos = end;
+    while(pos > 0 && isdigit((unsigned char) request[pos - 1])) pos--;
+    if(pos == end || end - pos > 9 || pos < 3 || request[pos - 1] != '~' || request[pos - 2] != ' ') {
+        return false;
+    }
+
+    secs = strtoull(request.c_str() + pos, nullptr, 10);
+    if(secs == 0) return false;
+
+    request.erase(pos - 2, end - pos + 2);
+    return true;
+}
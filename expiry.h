@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __EXPIRY_H
+#define __EXPIRY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+
+namespace vortex {
+
+struct timer {
+    std::string name;
+    uint64_t expires;       // ms since epoch
+};
+
+// hierarchical timer wheel: four levels of 256 slots each. level 0 holds
+// timers due within 256 ticks, one slot per tick; each level above
+// covers 256 times the span of the one below. adding a timer and
+// advancing one tick are O(1); a timer moves down a level when the
+// slot it waits in comes round (a cascade), at most three times.
+class timer_wheel {
+
+protected:
+    static const int levels = 4;
+    static const int slot_bits = 8;
+    static const uint64_t slots = 1 << slot_bits;
+
+    uint64_t _tick_ms;
+    uint64_t _now = 0;              // current tick
+    std::vector<timer> _wheel[levels][slots];
+    size_t _pending = 0;
+
+    void place(timer &&t, uint64_t tick);
+
+public:
+    timer_wheel(uint64_t tick_ms, uint64_t now_ms): _tick_ms(tick_ms), _now(now_ms / tick_ms) {}
+
+    void add(timer &&t);
+
+    // advance to now_ms, moving timers that are due to out
+    void advance(uint64_t now_ms, std::vector<timer> &out);
+
+    size_t pending() { return _pending; }
+};
+
+struct expiry_stats {
+    size_t pending;         // keys with a timer not yet due
+    uint64_t expired;       // keys expired since the last call
+};
+
+// expires keys with a ttl. schedule() puts the key's expiry on a timer
+// wheel; a thread advances the wheel every tick and hands each due key to
+// the expire function, which removes it and returns true unless the key
+// was written again since.
+//
+// a key has one timer however often it is written. a later expiry only
+// updates the key's due time, and the timer is put back on the wheel for
+// it when it fires; an earlier expiry queues a new timer, and the old one
+// is discarded when it fires.
+class expirer {
+
+protected:
+    struct key_timer {
+        uint64_t queued;    // expiry of the timer on the wheel
+        uint64_t due;       // expiry the key has now
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    timer_wheel _wheel;
+    std::unordered_map<std::string,key_timer> _keys;
+    std::thread _thread;
+    bool _done = false;
+
+    bool (*_expire)(const std::string &name, uint64_t expires) = nullptr;
+    std::atomic<uint64_t> _expired;
+
+    void run();
+
+public:
+    expirer();
+    ~expirer();
+
+    // start expiring with expire; keys scheduled before wait until then
+    void start(bool (*expire)(const std::string &name, uint64_t expires));
+
+    void schedule(const std::string &name, uint64_t expires);
+
+    // counters since the last call, which resets them
+    void stats(expiry_stats &out);
+};
+
+extern expirer expiry;
+
+// strip a trailing " ~secs" ttl from a "+key value" request, keeping any
+// newline after it; false if the request has none
+bool parse_ttl(std::string &request, uint64_t &secs);
+
+}
+
+#endif  // __EXPIRY_H
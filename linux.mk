@@ -37,8 +37,20 @@ EXE = vortex
 OBJS = \
 	main.o \
 	storage.o \
+	shard_store.o \
+	reclaimer.o \
+	record.o \
+	snapshot.o \
 	server.o \
-	logger.o
+	logger.o \
+	output.o \
+	publish.o \
+	reactor.o \
+	scheduler.o \
+	replication.o \
+	protocol.o \
+	evictor.o \
+	expiry.o
     
 default: all
 
@@ -47,7 +59,7 @@ CM_LIB_DIR=../../common
 INCLUDE = -I. -I$(CM_LIB_DIR)/include
 #LDFLAGS = -m64 -g -lcm_64 -ldl -pthread -lssl -L$(CM_LIB_DIR)/lib
 LDFLAGS = -m64 -g -Wl,-Bstatic -lcm_64 -Wl,-Bdynamic -pthread -lssl -lcrypto -L$(CM_LIB_DIR)/lib
-CCFLAGS = -m64 -g $(INCLUDE) -c -fPIC -D__LINUX_BOX__ -D_REENTRANT -D_LARGEFILE64_SOURCE -DVERSION=\"$(CM_VERSION)\"
+CCFLAGS = -std=gnu++17 -m64 -g $(INCLUDE) -c -fPIC -D__LINUX_BOX__ -D_REENTRANT -D_LARGEFILE64_SOURCE -DVERSION=\"$(CM_VERSION)\"
 
 POSIXFLAGS = -D_POSIX_PTHREAD_SEMANTICS -D_REENTRANT
 
@@ -38,8 +38,20 @@ EXE = vortex
 OBJS = \
 	main.o \
 	storage.o \
+	shard_store.o \
+	reclaimer.o \
+	record.o \
+	snapshot.o \
 	server.o \
-	logger.o
+	logger.o \
+	output.o \
+	publish.o \
+	reactor.o \
+	scheduler.o \
+	replication.o \
+	protocol.o \
+	evictor.o \
+	expiry.o
     
 default: all
 
@@ -48,7 +60,7 @@ CM_LIB_DIR=../../common
 INCLUDE = -I. -I$(CM_LIB_DIR)/include
 #LDFLAGS = -m$(WORD_SIZE) -g -lcm_$(WORD_SIZE) -ldl -pthread -lssl -lcrypto -L$(CM_LIB_DIR)/lib
 LDFLAGS = -m$(WORD_SIZE) -g -Wl,-Bstatic -lcm_$(WORD_SIZE) -Wl,-Bdynamic -pthread -lssl -lcrypto -L$(CM_LIB_DIR)/lib
-CCFLAGS = -m$(WORD_SIZE) -g $(INCLUDE) -c -fPIC -D__LINUX_BOX__ -D_REENTRANT -D_LARGEFILE$(WORD_SIZE)_SOURCE -DVERSION=\"$(CM_VERSION)\"
+CCFLAGS = -std=gnu++17 -m$(WORD_SIZE) -g $(INCLUDE) -c -fPIC -D__LINUX_BOX__ -D_REENTRANT -D_LARGEFILE$(WORD_SIZE)_SOURCE -DVERSION=\"$(CM_VERSION)\"
 
 POSIXFLAGS = -D_POSIX_PTHREAD_SEMANTICS -D_REENTRANT
 
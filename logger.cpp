@@ -27,7 +27,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
 #include "logger.h"
+#include "record.h"
+#include "replication.h"
 
 cm_log::multiplex_logger mx_log;
 cm_log::rolling_file_logger
@@ -53,12 +64,6 @@ void vortex::init_logs(cm_log::level::en lvl, int interval, int keep, cm_log::le
 
     set_default_logger(&mx_log);
 
-    // setup journal log
-    journal.set_log_level(cm_log::level::trace);
-    journal.set_date_time_format("%s");
-    journal.set_message_format("${date_time}${millis} ${msg}");
-    journal.set_RS(""); // do not append '\n'
-    
     if(60 <= interval && interval <= ((24*60)*60)) {
         journal.set_interval(interval);
     }
@@ -68,12 +73,344 @@ void vortex::init_logs(cm_log::level::en lvl, int interval, int keep, cm_log::le
     }
 }
 
-void vortex::journal_logger::rotate() {
+struct vortex::journal_waiter {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    bool ok = true;
+};
+
+static const size_t max_batch = 4096;
+
+// write every byte described by iov, resuming after partial writes
+static bool writev_all(int fd, std::vector<struct iovec> &iov) {
+
+    size_t index = 0;
+    while(index < iov.size()) {
+        int cnt = (int) std::min(iov.size() - index, (size_t) IOV_MAX);
+        ssize_t n = ::writev(fd, &iov[index], cnt);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            cm_log::error(cm_util::format("journal: writev: %s", strerror(errno)));
+            return false;
+        }
+
+        // skip what was written; trim a partially written iovec
+        while(n > 0 && index < iov.size()) {
+            if((size_t) n >= iov[index].iov_len) {
+                n -= iov[index].iov_len;
+                index++;
+            }
+            else {
+                iov[index].iov_base = (char *) iov[index].iov_base + n;
+                iov[index].iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+    return true;
+}
+
+vortex::journal_logger::~journal_logger() {
+    done.store(true);
+    {
+        std::lock_guard<std::mutex> guard(wait_mutex);
+        wait_cond.notify_one();
+    }
+    if(writer.joinable()) writer.join();
+    close();
+}
+
+bool vortex::journal_logger::open() {
+
+    std::string file = path();
+
+    // roll over an existing journal that was written in the other format;
+    // this happens in start(), before any write has been stamped
+    struct stat st;
+    if(stat(file.c_str(), &st) == 0 && st.st_size > 0) {
+        char buf[journal_header_size];
+        int rfd = ::open(file.c_str(), O_RDONLY);
+        ssize_t n = rfd >= 0 ? ::read(rfd, buf, sizeof(buf)) : -1;
+        if(rfd >= 0) ::close(rfd);
+        bool binary = n > 0 && is_journal_header(buf, (size_t) n);
+        if(binary != (format == journal_format::binary)) {
+            vortex::advance_segment();
+            roll();
+            rolled = true;
+        }
+    }
+
+    fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd == -1) {
+        cm_log::critical(cm_util::format("journal: open: %s: %s", file.c_str(), strerror(errno)));
+        return false;
+    }
+
+    if(format == journal_format::binary && lseek(fd, 0, SEEK_END) == 0) {
+        std::string header;
+        encode_journal_header(header);
+        std::vector<struct iovec> iov(1);
+        iov[0].iov_base = (void *) header.c_str();
+        iov[0].iov_len = header.size();
+        writev_all(fd, iov);
+    }
+
+    time_t now = time(NULL);
+    if(interval > 0) {
+        next_rotation = ((now / interval) + 1) * interval;
+    }
+    return true;
+}
+
+void vortex::journal_logger::close() {
+    if(fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void vortex::journal_logger::start() {
+    std::call_once(writer_started, [this] {
+        lock();
+        open();
+        unlock();
+        if(rolled) {
+            rolled = false;
+            vortex::rotate_storage();
+        }
+        writer = std::thread(&journal_logger::run, this);
+    });
+}
+
+void vortex::journal_logger::wake() {
+    if(sleeping.load()) {
+        std::lock_guard<std::mutex> guard(wait_mutex);
+        wait_cond.notify_one();
+    }
+}
+
+vortex::journal_entry *vortex::journal_logger::make_entry(char op, const std::string &name,
+    const std::string &value, const std::string &request, const vortex::origin *from, uint64_t expires) {
+
+    start();
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    journal_entry *e = new journal_entry();
+    e->op = op;
+    e->millis = (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    e->expires = expires;
+    e->name = name;
+    e->value = value;
+    if(format == journal_format::text) {
+        e->request = request;
+    }
+    if(from != nullptr) {
+        e->origin = *from;
+    }
+    return e;
+}
+
+void vortex::journal_logger::post(char op, const std::string &name, const std::string &request) {
+    queue.push(make_entry(op, name, std::string(), request, nullptr, 0));
+    wake();
+}
+
+bool vortex::journal_logger::append(char op, const std::string &name, const std::string &value,
+    const std::string &request, const vortex::origin *from, uint64_t expires) {
+
+    journal_entry *e = make_entry(op, name, value, request, from, expires);
+
+    journal_waiter waiter;
+    bool wait = sync == journal_sync::batch;
+    if(wait) e->waiter = &waiter;
+
+    queue.push(e);
+    wake();
 
-    // do normal log rotation
-    cm_log::rolling_file_logger::rotate();
+    if(!wait) return true;
 
-    // swap in remaining journals
-    // this effectively removes the oldest data
-    vortex::rotate_storage();
+    // durable: acknowledge only after our batch has been synced
+    std::unique_lock<std::mutex> guard(waiter.mutex);
+    waiter.cond.wait(guard, [&waiter] { return waiter.done; });
+    return waiter.ok;
+}
+
+bool vortex::journal_logger::write_entries(std::vector<journal_entry *> &batch) {
+
+    std::vector<struct iovec> iov;
+    iov.reserve(batch.size() * 3);
+
+    auto add = [&iov](const void *p, size_t len) {
+        if(len == 0) return;
+        struct iovec v;
+        v.iov_base = (void *) p;
+        v.iov_len = len;
+        iov.push_back(v);
+    };
+
+    for(auto e: batch) {
+        uint64_t seq = sequence.fetch_add(1) + 1;
+        e->seq = seq;
+        if(format == journal_format::binary) {
+            encode_record_header(e->header, (uint8_t) e->op, 0, seq, e->millis,
+                e->name.c_str(), e->name.size(), e->value.c_str(), e->value.size(), e->expires);
+            e->header_len = record_header_size;
+            add(e->header, e->header_len);
+            add(e->name.c_str(), e->name.size());
+            add(e->value.c_str(), e->value.size());
+            if(e->expires > 0) {
+                encode_expiry(e->tail, e->expires);
+                add(e->tail, expiry_size);
+            }
+        }
+        else {
+            e->header_len = snprintf(e->header, sizeof(e->header), "%ld.%03d ",
+                (long) (e->millis / 1000), (int) (e->millis % 1000));
+            add(e->header, e->header_len);
+            size_t len = e->request.size();
+            if(len > 0 && e->request.back() == '\n') len--;
+            add(e->request.c_str(), len);
+            if(e->expires > 0) {
+                // seconds left from the line's timestamp, rounded up
+                uint64_t ttl = e->expires > e->millis ? (e->expires - e->millis + 999) / 1000 : 1;
+                e->tail_len = snprintf(e->tail, sizeof(e->tail), " ~%llu", (unsigned long long) ttl);
+                add(e->tail, e->tail_len);
+            }
+            add("\n", 1);
+        }
+    }
+
+    return writev_all(fd, iov);
+}
+
+void vortex::journal_logger::commit(std::vector<journal_entry *> &batch, bool ok) {
+
+    // replicate what reached the journal, in journal order
+    if(ok) {
+        std::vector<vortex::mutation> mutations;
+        mutations.reserve(batch.size());
+        for(auto e: batch) {
+            mutations.push_back({ e->seq, e->millis, e->op, std::move(e->name),
+                std::move(e->value), e->origin, e->expires });
+        }
+        vortex::replication.publish(mutations);
+    }
+
+    for(auto e: batch) {
+        if(e->waiter != nullptr) {
+            journal_waiter &w = *e->waiter;
+            std::lock_guard<std::mutex> guard(w.mutex);
+            w.ok = ok;
+            w.done = true;
+            w.cond.notify_one();
+        }
+        delete e;
+    }
+    batch.clear();
+}
+
+size_t vortex::journal_logger::write_batch(size_t max, bool &dirty) {
+
+    std::vector<journal_entry *> batch;
+    journal_entry *e;
+    while(batch.size() < max && (e = queue.pop()) != nullptr) {
+        batch.push_back(e);
+    }
+    if(batch.empty()) return 0;
+
+    size_t n = batch.size();
+    bool ok = (fd != -1 || open()) && write_entries(batch);
+    if(ok && sync == journal_sync::batch) {
+        if(fdatasync(fd) != 0) {
+            cm_log::error(cm_util::format("journal: fdatasync: %s", strerror(errno)));
+            ok = false;
+        }
+    }
+    else if(ok) {
+        dirty = true;
+    }
+
+    commit(batch, ok);
+    return n;
+}
+
+void vortex::journal_logger::run() {
+
+    bool dirty = false;
+    auto last_sync = std::chrono::steady_clock::now();
+
+    while(!done.load()) {
+
+        time_t now = time(NULL);
+        if(rotate_requested.exchange(false) || (next_rotation > 0 && now >= next_rotation)) {
+            // appends that return after this point stamp the next segment;
+            // everything queued before it belongs in the journal retiring now
+            vortex::advance_segment();
+            while(write_batch(max_batch, dirty) > 0) {}
+
+            lock();
+            if(fd != -1 && sync != journal_sync::none) fdatasync(fd);
+            close();
+            roll();
+            open();
+            unlock();
+            dirty = false;
+
+            // evict keys whose newest write is in a journal that was dropped
+            // this effectively removes the oldest data
+            vortex::rotate_storage();
+        }
+
+        size_t n = write_batch(max_batch, dirty);
+
+        if(sync == journal_sync::interval && dirty) {
+            auto t = std::chrono::steady_clock::now();
+            if(t - last_sync >= std::chrono::milliseconds(sync_interval)) {
+                if(fdatasync(fd) != 0) {
+                    cm_log::error(cm_util::format("journal: fdatasync: %s", strerror(errno)));
+                }
+                last_sync = t;
+                dirty = false;
+            }
+        }
+
+        if(n > 0) continue;
+
+        // nothing queued: sleep until an append wakes us, the sync interval
+        // is due or it is time to check for rotation
+        int timeout = 100;
+        if(sync == journal_sync::interval && dirty && sync_interval < timeout) {
+            timeout = std::max(sync_interval, 1);
+        }
+
+        std::unique_lock<std::mutex> guard(wait_mutex);
+        sleeping.store(true);
+        if(queue.empty() && !done.load() && !rotate_requested.load()) {
+            wait_cond.wait_for(guard, std::chrono::milliseconds(timeout));
+        }
+        sleeping.store(false);
+    }
+
+    // drain what was queued before shutdown
+    while(write_batch(max_batch, dirty) > 0) {}
+    if(fd != -1 && sync != journal_sync::none) fdatasync(fd);
+}
+
+void vortex::journal_logger::roll() {
+
+    std::string file = path();
+    struct stat st;
+    if(stat(file.c_str(), &st) == 0 && st.st_size > 0) {
+        files.rotate();
+    }
+}
+
+void vortex::journal_logger::rotate() {
+    start();
+    rotate_requested.store(true);
+    std::lock_guard<std::mutex> guard(wait_mutex);
+    wait_cond.notify_one();
 }
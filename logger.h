@@ -30,20 +30,150 @@
 #ifndef __LOGGER_H
 #define __LOGGER_H
 
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 #include "log.h"
 #include "storage.h"
+#include "mpsc_queue.h"
+#include "record.h"
 
 namespace vortex {
 
-class journal_logger: public cm_log::rolling_file_logger {
+enum class journal_format { text, binary };
+
+// when the journal writer calls fdatasync()
+enum class journal_sync { none, batch, interval };
+
+// one queued mutation; filled by the caller, encoded by the writer
+struct journal_entry {
+    std::atomic<journal_entry *> next;
+    char op = 0;
+    std::string name;
+    std::string value;
+    std::string request;
+    vortex::origin origin;      // servers it came through, if replicated
+    uint64_t seq = 0;
+    uint64_t millis = 0;
+    uint64_t expires = 0;       // ms since epoch of a key with a ttl
+    char header[32];            // record header or text timestamp prefix
+    size_t header_len = 0;
+    char tail[32];              // record expiry or text ttl suffix
+    size_t tail_len = 0;
+    struct journal_waiter *waiter = nullptr;
+};
+
+// rolling journal of mutations
+//
+// text journals hold one "<seconds>.<millis> <request>" line per mutation,
+// binary journals hold length-prefixed, checksummed records (see record.h).
+// a key written with a ttl keeps it: as a " ~<seconds>" suffix on the text
+// line, counted from its timestamp, or as the record's expiry time.
+// a journal file only ever holds one format; when the configured format
+// differs from the current file's, the file is rolled over first.
+//
+// append() copies the mutation into an entry and only queues it on a
+// lock-free queue; a single writer thread drains the queue in batches,
+// encodes them and writes each batch with writev() from the entries, then
+// syncs according to the journal_sync policy. with journal_sync::batch,
+// append() returns once the caller's batch is on disk, or false if it
+// could not be synced; the request is then failed rather than applied.
+// each written batch then goes to the replicator under its journal
+// sequence numbers, so a peer can resume from a journal position.
+
+class journal_logger: public cm::mutex {
+
+protected:
+    std::string dir;
+    std::string base_name;
+    std::string ext;
+    time_t interval;
+    int keep;
+
+    journal_format format = journal_format::text;
+    journal_sync sync = journal_sync::none;
+    int sync_interval = 0;      // ms, for journal_sync::interval
+
+    int fd = -1;
+    time_t next_rotation = 0;
+    std::atomic<uint64_t> sequence;
+
+    // renames and retires rotated journals; it never writes itself, so
+    // rotated journals keep the names and retention of earlier releases
+    cm_log::rolling_file_logger files;
+
+    mpsc_queue<journal_entry> queue;
+    std::thread writer;
+    std::once_flag writer_started;
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond;
+    std::atomic<bool> sleeping;
+    std::atomic<bool> rotate_requested;
+    std::atomic<bool> done;
+    bool rolled = false;        // open() rolled over a journal
+
+    std::string path() { return dir + base_name + ext; }
+    bool open();
+    void close();
+
+    // rename the current journal aside and drop journals beyond keep
+    void roll();
+
+    void wake();
+    void run();
+
+    journal_entry *make_entry(char op, const std::string &name, const std::string &value,
+        const std::string &request, const vortex::origin *from, uint64_t expires);
+
+    // encode, write and commit up to max queued entries; returns the
+    // number taken from the queue. dirty is set if data awaits a sync
+    size_t write_batch(size_t max, bool &dirty);
+    bool write_entries(std::vector<journal_entry *> &batch);
+    void commit(std::vector<journal_entry *> &batch, bool ok);
 
 public:
     journal_logger(const std::string _dir, const std::string _base_name,
-             const std::string _ext, time_t _interval, int _keep = 0): 
-        cm_log::rolling_file_logger(_dir, _base_name, _ext, _interval, _keep) { }
-    
-    ~journal_logger() { }
+             const std::string _ext, time_t _interval, int _keep = 0):
+        dir(_dir), base_name(_base_name), ext(_ext), interval(_interval), keep(_keep),
+        sequence(0), files(_dir, _base_name, _ext, _interval, _keep),
+        sleeping(false), rotate_requested(false), done(false) { }
+
+    ~journal_logger();
+
+    void set_interval(time_t _interval) { interval = _interval; files.set_interval(_interval); }
+    void set_keep(int _keep) { keep = _keep; files.set_keep(_keep); }
+
+    void set_format(journal_format _format) { format = _format; }
+    journal_format get_format() { return format; }
+
+    void set_sync(journal_sync _sync, int _interval = 0) { sync = _sync; sync_interval = _interval; }
+    journal_sync get_sync() { return sync; }
+
+    // continue sequence numbers after those found on replay
+    void set_sequence(uint64_t seq) { sequence.store(seq); }
+    uint64_t get_sequence() { return sequence.load(); }
+
+    void rotation_list_add(const std::string &path) { files.rotation_list_add(path); }
+
+    // open the journal and start the writer thread (once)
+    void start();
+
+    // queue one mutation (op is '+', '-' or '!'); request is the text form,
+    // from the servers a replicated mutation came through and expires the
+    // expiry time of a key with a ttl (ms since epoch).
+    // returns false if the mutation could not be made durable when the
+    // sync policy requires it
+    bool append(char op, const std::string &name, const std::string &value,
+        const std::string &request, const vortex::origin *from = nullptr, uint64_t expires = 0);
+
+    // queue a delete no client waits on, such as an eviction, without
+    // waiting for its sync, whatever the sync policy
+    void post(char op, const std::string &name, const std::string &request);
 
+    // roll over on the writer thread at the next opportunity
     void rotate();
 };
 
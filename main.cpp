@@ -30,6 +30,8 @@
 #include <unistd.h>     // for getopt()
 #include "vortex.h"
 
+extern vortex::journal_logger journal;
+
 
 const char *__banner__ =
 R"(         ______)""\n"
@@ -46,7 +48,7 @@ R"(        \______/)""\n";
 
 
 void usage(int argc, char *argv[]) {
-    printf("usage: %s [-p<port>] [-l<level>] [-L<level>] [-i<interval>] [-k<keep>] [-c <host>:<port>] [-v]\n", argv[0]);
+    printf("usage: %s [-p<port>] [-l<level>] [-L<level>] [-i<interval>] [-k<keep>] [-c <host>:<port>] [-s<shards>] [-j<format>] [-f<sync>] [-S<seconds>] [-q<depth>] [-Q<policy>] [-H<hops>] [-r<reactors>] [-a] [-t<threads>] [-m<bytes>] [-e<policy>] [-v]\n", argv[0]);
     puts("");
     puts("-p port       Listen on port");
     puts("-l level      Log level (default 8=trace)");
@@ -62,8 +64,23 @@ void usage(int argc, char *argv[]) {
     puts("-L level      Console log level (default 0=off)");
     puts("-i interval   Cache rotation interval");
     puts("-k keep       Number of journal logs to keep in rotation");
-    puts("-c host:port  Connect to host and port");
+    puts("-c host:port  Connect to host and port (needs -j binary)");
     puts("-n name       Name for this instance");
+    puts("-s shards     Number of store shards (default 4 per core)");
+    puts("-j format     Journal format: text (default) or binary");
+    puts("-f sync       Journal sync: none (default), batch (ack after fdatasync)");
+    puts("              or a number of ms between fdatasync calls");
+    puts("-S seconds    Snapshot interval, binary journals only (default 0=off)");
+    puts("-q depth      Notifications queued per subscriber (default 1024)");
+    puts("-Q policy     Slow subscriber policy: drop (default), conflate or disconnect");
+    puts("-H hops       Longest chain of watch publishes (default 16)");
+    puts("-r reactors   Serve from this many event loops sharing the port (default 0=single listener)");
+    puts("-a            Pin each reactor thread to a cpu");
+    puts("-t threads    Run requests on a work-stealing pool of this many threads");
+    puts("              (default 0=fixed pool of 6)");
+    puts("-m bytes      Memory budget for the store, with optional K, M or G suffix");
+    puts("              (default 0=unlimited)");
+    puts("-e policy     Eviction over the budget: lru (default) or lfu");
     puts("-v            Output version/build info to console and exit");
     puts("");
 }
@@ -83,10 +100,23 @@ int main(int argc, char *argv[]) {
     std::string host_name = "localhost";
     int host_port = -1;
     std::string instance_name = "vortex";
+    int shards = 0;
+    vortex::journal_format format = vortex::journal_format::text;
+    vortex::journal_sync sync = vortex::journal_sync::none;
+    int sync_interval = 0;
+    int snapshot_interval = 0;
+    int queue_depth = 1024;
+    vortex::slow_consumer policy = vortex::slow_consumer::drop_oldest;
+    int max_hops = 16;
+    int reactors = 0;
+    bool pin_reactors = false;
+    int threads = 0;
+    size_t memory_budget = 0;
+    vortex::eviction_policy eviction_policy = vortex::eviction_policy::lru;
 
     std::vector<std::string> v;
 
-    while((opt = getopt(argc, argv, "hl:L:p:i:k:c:n:v")) != -1) {
+    while((opt = getopt(argc, argv, "hl:L:p:i:k:c:n:s:j:f:S:q:Q:H:r:at:m:e:v")) != -1) {
         switch(opt) {
             case 'p':
                 port = atoi(optarg);
@@ -108,6 +138,76 @@ int main(int argc, char *argv[]) {
                 instance_name = std::string(optarg);
                 break;
 
+            case 's':
+                shards = atoi(optarg);
+                break;
+
+            case 'j':
+                if(std::string(optarg) == "binary") {
+                    format = vortex::journal_format::binary;
+                }
+                break;
+
+            case 'f':
+                if(std::string(optarg) == "batch") {
+                    sync = vortex::journal_sync::batch;
+                }
+                else if(atoi(optarg) > 0) {
+                    sync = vortex::journal_sync::interval;
+                    sync_interval = atoi(optarg);
+                }
+                break;
+
+            case 'S':
+                snapshot_interval = atoi(optarg);
+                break;
+
+            case 'q':
+                queue_depth = atoi(optarg);
+                break;
+
+            case 'Q':
+                if(std::string(optarg) == "conflate") {
+                    policy = vortex::slow_consumer::conflate;
+                }
+                else if(std::string(optarg) == "disconnect") {
+                    policy = vortex::slow_consumer::disconnect;
+                }
+                break;
+
+            case 'H':
+                max_hops = atoi(optarg);
+                break;
+
+            case 'r':
+                reactors = atoi(optarg);
+                break;
+
+            case 'a':
+                pin_reactors = true;
+                break;
+
+            case 't':
+                threads = atoi(optarg);
+                break;
+
+            case 'm': {
+                char *suffix = nullptr;
+                memory_budget = strtoull(optarg, &suffix, 10);
+                switch(toupper(*suffix)) {
+                    case 'K': memory_budget <<= 10; break;
+                    case 'M': memory_budget <<= 20; break;
+                    case 'G': memory_budget <<= 30; break;
+                }
+                break;
+            }
+
+            case 'e':
+                if(std::string(optarg) == "lfu") {
+                    eviction_policy = vortex::eviction_policy::lfu;
+                }
+                break;
+
             case 'l':
                 log_lvl = atoi(optarg);
                 break;
@@ -136,8 +236,32 @@ int main(int argc, char *argv[]) {
     
     if(version) exit(0);
 
+    // replicated keys and values are raw bytes; a text journal would
+    // write them as request lines that replay differently
+    if(host_port != -1 && format != vortex::journal_format::binary) {
+        cm_log::critical("replication (-c) needs the binary journal (-j binary)");
+        exit(1);
+    }
+
+    if(shards > 0) {
+        vortex::init_store(shards);
+    }
+
+    vortex::backlog.set_policy(policy, queue_depth > 0 ? queue_depth : 1024);
+    vortex::publisher.set_max_hops(max_hops > 0 ? max_hops : 16);
+
+    journal.set_format(format);
+    journal.set_sync(sync, sync_interval);
+
     vortex::init_storage();
-    vortex::run(port, host_name, host_port, instance_name);
+    journal.start();
+    vortex::start_snapshots(snapshot_interval);
+    vortex::eviction.start(memory_budget, eviction_policy);
+    if(threads > 0) {
+        vortex::tasks.start(threads);
+    }
+
+    vortex::run(port, host_name, host_port, instance_name, reactors, pin_reactors);
 
     return 0;
 }
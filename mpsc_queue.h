@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MPSC_QUEUE_H
+#define __MPSC_QUEUE_H
+
+#include <atomic>
+#include <thread>
+
+namespace vortex {
+
+// intrusive multi-producer, single-consumer queue (after D. Vyukov)
+//
+// push() is wait free: one exchange plus one store. pop() may only be
+// called from the single consumer thread; it returns nullptr only when no
+// push has started, and spins briefly past a producer that has claimed
+// its slot but not yet linked it, so an empty result is exact.
+//
+// T must have a member: std::atomic<T *> next
+
+template<class T>
+class mpsc_queue {
+
+protected:
+    std::atomic<T *> _head;     // last pushed node (producers)
+    T *_tail;                   // next node to pop (consumer)
+    T _stub;
+
+    static T *wait_next(T *n) {
+        T *next;
+        while((next = n->next.load(std::memory_order_acquire)) == nullptr) {
+            std::this_thread::yield();
+        }
+        return next;
+    }
+
+public:
+    mpsc_queue(): _head(&_stub), _tail(&_stub) {
+        _stub.next.store(nullptr);
+    }
+
+    void push(T *n) {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        T *prev = _head.exchange(n);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // consumer only; a push that has started counts as not empty
+    bool empty() {
+        return _tail == &_stub && _head.load() == &_stub;
+    }
+
+    T *pop() {
+        T *tail = _tail;
+        T *next = tail->next.load(std::memory_order_acquire);
+
+        if(tail == &_stub) {
+            if(next == nullptr) {
+                if(_head.load(std::memory_order_acquire) == &_stub) return nullptr;
+                next = wait_next(tail);
+            }
+            _tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if(next != nullptr) {
+            _tail = next;
+            return tail;
+        }
+
+        if(tail != _head.load(std::memory_order_acquire)) {
+            _tail = wait_next(tail);
+            return tail;
+        }
+
+        // tail is the last node: queue the stub behind it so tail can go
+        push(&_stub);
+        _tail = wait_next(tail);
+        return tail;
+    }
+};
+
+}
+
+#endif  // __MPSC_QUEUE_H
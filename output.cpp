@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "network.h"
+#include "output.h"
+
+vortex::output_backlog vortex::backlog;
+
+// batch open on this thread, if any
+static thread_local vortex::output_batch *open_batch = nullptr;
+
+// flush a batch early once it holds this much
+static const size_t max_batch_size = 256 * 1024;
+
+// messages handed to one writev
+static const int max_iov = 64;
+
+// responses queued for a socket are bounded by the notification limit, but
+// never below this; replication writes up to 16 batches ahead of a peer
+static const size_t min_response_limit = 64;
+
+// send without blocking; returns bytes sent or -1 on a hard error
+static ssize_t send_some(int fd, const char *buf, size_t sz) {
+    for(;;) {
+        ssize_t n = ::send(fd, buf, sz, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n >= 0) return n;
+        if(errno == EINTR) continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
+}
+
+vortex::output_backlog::output_backlog():
+    _policy(slow_consumer::drop_oldest), _limit(1024) {
+    _wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+vortex::output_backlog::~output_backlog() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    wake();
+    if(_thread.joinable()) _thread.join();
+    if(_wake != -1) close(_wake);
+}
+
+void vortex::output_backlog::set_policy(slow_consumer policy, size_t limit) {
+    _policy = policy;
+    _limit = limit > 0 ? limit : 1;
+}
+
+void vortex::output_backlog::wake() {
+    uint64_t one = 1;
+    ssize_t n = ::write(_wake, &one, sizeof(one));
+    (void) n;
+}
+
+// called with the stripe locked
+void vortex::output_backlog::start_polling(int fd, connection &c) {
+    if(c.polling) return;
+    c.polling = true;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _polling.insert(fd);
+        if(!_thread.joinable()) {
+            _thread = std::thread(&output_backlog::run, this);
+        }
+    }
+    wake();
+}
+
+// called with the stripe locked
+void vortex::output_backlog::drop_oldest(connection &c) {
+    auto it = c.queue.begin();
+    // the front message may be partly on the wire already
+    if(c.offset > 0 && it != c.queue.end()) it++;
+    while(it != c.queue.end() && it->key.empty()) it++;
+    if(it == c.queue.end()) return;
+
+    auto k = c.keys.find(it->key);
+    if(k != c.keys.end() && k->second == it) c.keys.erase(k);
+    c.queue.erase(it);
+    c.notifications--;
+    c.dropped++;
+}
+
+// called with the stripe locked
+void vortex::output_backlog::disconnect(int fd, connection &c) {
+    c.closing = true;
+    c.dropped += c.notifications;
+    c.queue.clear();
+    c.keys.clear();
+    c.notifications = 0;
+    c.offset = 0;
+    shutdown(fd, SHUT_RDWR);
+}
+
+// called with the stripe locked
+bool vortex::output_backlog::flush(int fd, connection &c) {
+
+    while(!c.queue.empty()) {
+        iovec iov[max_iov];
+        int n = 0;
+        for(auto it = c.queue.begin(); it != c.queue.end() && n < max_iov; it++, n++) {
+            size_t skip = n == 0 ? c.offset : 0;
+            iov[n].iov_base = (void *) (it->data.data() + skip);
+            iov[n].iov_len = it->data.size() - skip;
+        }
+
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t written = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+
+        // pop what went out whole; remember how far into the next one
+        size_t left = (size_t) written;
+        while(left > 0) {
+            message &m = c.queue.front();
+            size_t rest = m.data.size() - c.offset;
+            if(left < rest) {
+                c.offset += left;
+                // partly written: no longer conflatable
+                if(!m.key.empty()) {
+                    auto k = c.keys.find(m.key);
+                    if(k != c.keys.end() && k->second == c.queue.begin()) c.keys.erase(k);
+                }
+                break;
+            }
+            left -= rest;
+            if(!m.key.empty()) {
+                auto k = c.keys.find(m.key);
+                if(k != c.keys.end() && k->second == c.queue.begin()) c.keys.erase(k);
+                c.notifications--;
+            }
+            c.queue.pop_front();
+            c.offset = 0;
+            c.sent++;
+        }
+    }
+    return true;
+}
+
+void vortex::output_backlog::write(int fd, const char *buf, size_t sz) {
+
+    stripe &s = get_stripe(fd);
+    std::unique_lock<std::mutex> guard(s.mutex);
+
+    // a socket only has a connection once something was queued for it
+    auto it = s.connections.find(fd);
+    connection *c = it != s.connections.end() ? &it->second : nullptr;
+    if(c != nullptr && c->closing) return;
+
+    // keep order: queue behind output the socket has not taken yet
+    if(c != nullptr && !c->queue.empty()) {
+        if(c->queue.size() - c->notifications >= std::max(_limit.load(), min_response_limit)) {
+            cm_log::warning(cm_util::format("%d: slow client: %lu responses queued, disconnecting",
+                fd, c->queue.size() - c->notifications));
+            disconnect(fd, *c);
+            return;
+        }
+        c->queue.push_back({ std::string(), std::string(buf, sz) });
+        return;
+    }
+
+    ssize_t n = send_some(fd, buf, sz);
+    if(n < 0) {
+        guard.unlock();
+        cm_net::err("output: send", errno);
+        return;
+    }
+    if((size_t) n == sz) {
+        if(c != nullptr) c->sent++;
+        return;
+    }
+
+    if(c == nullptr) c = &s.connections[fd];
+    c->queue.push_back({ std::string(), std::string(buf + n, sz - n) });
+    start_polling(fd, *c);
+}
+
+void vortex::output_backlog::notify(int fd, const std::string &key, std::string &&data) {
+
+    stripe &s = get_stripe(fd);
+    std::unique_lock<std::mutex> guard(s.mutex);
+
+    auto it = s.connections.find(fd);
+    connection *c = it != s.connections.end() ? &it->second : nullptr;
+    if(c != nullptr && c->closing) return;
+
+    // a socket with nothing queued takes the notification directly; the
+    // flusher only handles what it cannot take now
+    if(c == nullptr || c->queue.empty()) {
+        ssize_t n = send_some(fd, data.data(), data.size());
+        if(n < 0) {
+            guard.unlock();
+            cm_net::err("output: send", errno);
+            return;
+        }
+        if((size_t) n == data.size()) {
+            if(c != nullptr) c->sent++;
+            return;
+        }
+        if(c == nullptr) c = &s.connections[fd];
+        if(n > 0) {
+            // partly written, so no longer conflatable
+            c->queue.push_back({ key, std::move(data) });
+            c->offset = (size_t) n;
+            c->notifications++;
+            start_polling(fd, *c);
+            return;
+        }
+    }
+
+    slow_consumer policy = _policy;
+
+    // a subscriber that is keeping up has nothing queued for the key
+    if(policy == slow_consumer::conflate) {
+        auto k = c->keys.find(key);
+        if(k != c->keys.end()) {
+            k->second->data = std::move(data);
+            c->conflated++;
+            return;
+        }
+    }
+
+    if(c->notifications >= _limit) {
+        if(policy == slow_consumer::disconnect) {
+            cm_log::warning(cm_util::format("%d: slow consumer: %lu notifications queued, disconnecting",
+                fd, c->notifications));
+            disconnect(fd, *c);
+            return;
+        }
+
+        if(c->dropped == 0) {
+            cm_log::warning(cm_util::format("%d: slow consumer: dropping notifications", fd));
+        }
+        drop_oldest(*c);
+    }
+
+    c->queue.push_back({ key, std::move(data) });
+    c->notifications++;
+    c->keys[key] = std::prev(c->queue.end());
+    start_polling(fd, *c);
+}
+
+void vortex::output_backlog::remove(int fd) {
+    stripe &s = get_stripe(fd);
+    std::lock_guard<std::mutex> guard(s.mutex);
+    s.connections.erase(fd);
+}
+
+size_t vortex::output_backlog::depth(int fd) {
+    stripe &s = get_stripe(fd);
+    std::lock_guard<std::mutex> guard(s.mutex);
+    auto it = s.connections.find(fd);
+    return it != s.connections.end() ? it->second.queue.size() : 0;
+}
+
+void vortex::output_backlog::stats(std::vector<output_stats> &out) {
+    for(auto &s : _stripes) {
+        std::lock_guard<std::mutex> guard(s.mutex);
+        for(auto &it : s.connections) {
+            connection &c = it.second;
+            out.push_back({ it.first, c.queue.size(), c.notifications, c.sent, c.dropped, c.conflated });
+        }
+    }
+}
+
+void vortex::output_backlog::run() {
+
+    std::vector<pollfd> fds;
+
+    for(;;) {
+        fds.clear();
+        fds.push_back({ _wake, POLLIN, 0 });
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if(_done) return;
+            for(int fd : _polling) {
+                fds.push_back({ fd, POLLOUT, 0 });
+            }
+        }
+
+        if(poll(fds.data(), fds.size(), -1) <= 0) continue;
+
+        if(fds[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t n = read(_wake, &count, sizeof(count));
+            (void) n;
+        }
+
+        for(size_t i = 1; i < fds.size(); i++) {
+            pollfd &p = fds[i];
+            if(p.revents == 0) continue;
+
+            stripe &s = get_stripe(p.fd);
+            std::lock_guard<std::mutex> guard(s.mutex);
+
+            bool done = true;
+            auto it = s.connections.find(p.fd);
+            if(it != s.connections.end()) {
+                connection &c = it->second;
+                bool ok = !(p.revents & (POLLERR | POLLHUP | POLLNVAL)) && flush(p.fd, c);
+                if(!ok && !c.queue.empty()) {
+                    cm_log::warning(cm_util::format("%d: output: %lu messages dropped", p.fd, c.queue.size()));
+                    c.dropped += c.notifications;
+                    c.queue.clear();
+                    c.keys.clear();
+                    c.notifications = 0;
+                    c.offset = 0;
+                }
+                done = c.queue.empty();
+                if(done) c.polling = false;
+            }
+
+            if(done) {
+                std::lock_guard<std::mutex> guard(_mutex);
+                _polling.erase(p.fd);
+            }
+        }
+    }
+}
+
+vortex::output_batch::output_batch(int fd): _fd(fd), _outer(open_batch) {
+    open_batch = this;
+}
+
+vortex::output_batch::~output_batch() {
+    flush();
+    open_batch = _outer;
+}
+
+void vortex::output_batch::append(const char *buf, size_t sz) {
+    _buf.append(buf, sz);
+    if(_buf.size() >= max_batch_size) flush();
+}
+
+void vortex::output_batch::flush() {
+    if(_buf.empty()) return;
+    backlog.write(_fd, _buf.c_str(), _buf.size());
+    _buf.clear();
+}
+
+void vortex::send(int fd, const char *buf, size_t sz) {
+    if(nullptr != open_batch && open_batch->fd() == fd) {
+        open_batch->append(buf, sz);
+    }
+    else {
+        backlog.write(fd, buf, sz);
+    }
+}
+
+void vortex::notify(int fd, const std::string &key, std::string &&data) {
+    // responses already produced for this socket go first
+    if(nullptr != open_batch && open_batch->fd() == fd) {
+        open_batch->flush();
+    }
+    backlog.notify(fd, key, std::move(data));
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <string>
+#include <list>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+#include "log.h"
+
+namespace vortex {
+
+// what to do when a subscriber's notification queue is full
+enum class slow_consumer {
+    drop_oldest,    // drop the oldest queued notification
+    conflate,       // replace a queued notification for the same key
+    disconnect      // shut the subscriber's socket down
+};
+
+struct output_stats {
+    int fd;
+    size_t depth;           // queued messages
+    size_t notifications;   // queued notifications
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t conflated;
+};
+
+// per-socket outbound queues. sends never block the caller: responses are
+// written directly when the socket is idle, and whatever it cannot take is
+// queued. notifications are only queued, bounded per subscriber under the
+// slow-consumer policy, and written by a flusher thread as sockets drain.
+// responses cannot be dropped, so a client that lets more of them queue
+// up than the same limit (it pipelines without reading) is disconnected.
+class output_backlog {
+
+protected:
+    struct message {
+        std::string key;        // conflation key; empty for responses
+        std::string data;
+    };
+
+    typedef std::list<message> message_list;
+
+    struct connection {
+        message_list queue;
+        size_t offset = 0;          // bytes of the front message written
+        size_t notifications = 0;
+        std::unordered_map<std::string,message_list::iterator> keys;
+        uint64_t sent = 0;
+        uint64_t dropped = 0;
+        uint64_t conflated = 0;
+        bool polling = false;
+        bool closing = false;
+    };
+
+    // sockets are spread over stripes so sends to different sockets
+    // rarely share a lock
+    struct alignas(64) stripe {
+        std::mutex mutex;
+        std::unordered_map<int,connection> connections;
+    };
+
+    static const size_t num_stripes = 64;
+    stripe _stripes[num_stripes];
+
+    std::atomic<slow_consumer> _policy;
+    std::atomic<size_t> _limit;
+
+    // sockets the flusher waits on for POLLOUT
+    std::mutex _mutex;
+    std::set<int> _polling;
+    std::thread _thread;
+    int _wake = -1;
+    bool _done = false;
+
+    stripe &get_stripe(int fd) { return _stripes[(size_t) fd % num_stripes]; }
+
+    void run();
+    void wake();
+    void start_polling(int fd, connection &c);
+    void drop_oldest(connection &c);
+
+    // drop everything queued and shut the socket down; the server sees
+    // EOF and cleans up
+    void disconnect(int fd, connection &c);
+
+    // write queued messages until the socket would block; false on error
+    bool flush(int fd, connection &c);
+
+public:
+    output_backlog();
+    ~output_backlog();
+
+    // notifications queued per subscriber before the policy applies
+    void set_policy(slow_consumer policy, size_t limit);
+
+    // write a response to fd, queueing whatever the socket does not take
+    void write(int fd, const char *buf, size_t sz);
+
+    // queue a notification for fd; key identifies it for conflation
+    void notify(int fd, const std::string &key, std::string &&data);
+
+    // forget a closed socket's queued output
+    void remove(int fd);
+
+    // messages queued for fd that the socket has not taken yet
+    size_t depth(int fd);
+
+    void stats(std::vector<output_stats> &out);
+};
+
+extern output_backlog backlog;
+
+// responses to one socket collected while an input batch is processed
+// and written with a single send when the batch ends. while a batch is
+// open, vortex::send() to its socket on the same thread appends to it.
+class output_batch {
+
+protected:
+    int _fd;
+    std::string _buf;
+    output_batch *_outer;
+
+public:
+    output_batch(int fd);
+    ~output_batch();
+
+    int fd() { return _fd; }
+    void append(const char *buf, size_t sz);
+    void flush();
+};
+
+// send to a socket through the open batch or the backlog
+void send(int fd, const char *buf, size_t sz);
+
+inline void send(int fd, const std::string &s) {
+    send(fd, s.c_str(), s.size());
+}
+
+// queue a notification behind any response batched for the socket
+void notify(int fd, const std::string &key, std::string &&data);
+
+}
+
+#endif  // __OUTPUT_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "protocol.h"
+
+namespace {
+
+void put16(char *p, uint16_t v) {
+    for(int i = 0; i < 2; i++) p[i] = (char) (v >> (8 * i));
+}
+
+void put32(char *p, uint32_t v) {
+    for(int i = 0; i < 4; i++) p[i] = (char) (v >> (8 * i));
+}
+
+uint16_t get16(const char *p) {
+    return (uint16_t) ((uint8_t) p[0] | ((uint8_t) p[1] << 8));
+}
+
+uint32_t get32(const char *p) {
+    uint32_t v = 0;
+    for(int i = 3; i >= 0; i--) v = (v << 8) | (uint8_t) p[i];
+    return v;
+}
+
+}
+
+void vortex::encode_wire_frame(std::string &out, uint8_t op, uint8_t flags, uint32_t id,
+    std::string_view tag, std::string_view key, std::string_view value) {
+
+    char h[wire_header_size];
+    h[0] = (char) op;
+    h[1] = (char) flags;
+    put16(h + 2, (uint16_t) tag.size());
+    put32(h + 4, id);
+    put32(h + 8, (uint32_t) key.size());
+    put32(h + 12, (uint32_t) value.size());
+
+    out.reserve(out.size() + sizeof(h) + tag.size() + key.size() + value.size());
+    out.append(h, sizeof(h));
+    out.append(tag.data(), tag.size());
+    out.append(key.data(), key.size());
+    out.append(value.data(), value.size());
+}
+
+size_t vortex::decode_wire_frame(const char *buf, size_t len, wire_frame &f) {
+
+    if(len < wire_header_size) return 0;
+
+    size_t tag_len = get16(buf + 2);
+    uint64_t key_len = get32(buf + 8);
+    uint64_t value_len = get32(buf + 12);
+    uint64_t total = wire_header_size + tag_len + key_len + value_len;
+    if(len < total) return 0;
+
+    const char *p = buf + wire_header_size;
+    f.op = (uint8_t) buf[0];
+    f.flags = (uint8_t) buf[1];
+    f.id = get32(buf + 4);
+    f.tag = std::string_view(p, tag_len);
+    f.key = std::string_view(p + tag_len, (size_t) key_len);
+    f.value = std::string_view(p + tag_len + key_len, (size_t) value_len);
+    return (size_t) total;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROTOCOL_H
+#define __PROTOCOL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace vortex {
+
+// binary client protocol. a client upgrades by answering the hello:
+//
+//   server:  $:VORTEX
+//   client:  $:BINARY
+//   server:  $:BINARY
+//
+// frames carry raw keys and values that a text journal could not replay,
+// so a server with a text journal answers $:TEXT instead and the
+// connection stays on the text protocol. after $:BINARY, everything is
+// frames, in both directions:
+//
+//   frame:   op(u8) flags(u8) tag_len(u16) id(u32) key_len(u32) value_len(u32)
+//            tag key value
+//
+// all integers are little endian. requests use the operation characters
+// of the text grammar (+ $ ! - * @) with the key and value as raw bytes;
+// a watch carries its tag, and its publish target key as the value; a set
+// may carry its ttl in seconds, as decimal digits, in the tag. each
+// response echoes the op and id with a wire_status in flags, the key and
+// the value read or the number of keys removed. watch notifications have
+// op '#' and id 0, and carry the tag, the key that changed and its value.
+
+const size_t wire_header_size = 16;
+
+enum wire_status: uint8_t { wire_ok = 0, wire_not_found = 1, wire_error = 2 };
+
+struct wire_frame {
+    uint8_t op = 0;
+    uint8_t flags = 0;
+    uint32_t id = 0;
+    std::string_view tag;
+    std::string_view key;
+    std::string_view value;
+};
+
+// append a frame to out
+void encode_wire_frame(std::string &out, uint8_t op, uint8_t flags, uint32_t id,
+    std::string_view tag, std::string_view key, std::string_view value);
+
+// decode the frame at buf; views point into buf. returns bytes consumed,
+// or 0 if the frame is incomplete
+size_t decode_wire_frame(const char *buf, size_t len, wire_frame &f);
+
+}
+
+#endif  // __PROTOCOL_H
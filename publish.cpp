@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "publish.h"
+
+vortex::publish_stage vortex::publisher;
+
+// hops of the publish request being applied on this thread; 0 while a
+// client request is handled
+static thread_local int current_hops = 0;
+
+vortex::publish_stage::publish_stage():
+    _max_hops(16), _processed(0), _dropped(0), _total_us(0), _max_us(0) {}
+
+vortex::publish_stage::~publish_stage() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    _cond.notify_all();
+    for(auto &t : _threads) {
+        if(t.joinable()) t.join();
+    }
+}
+
+void vortex::publish_stage::start(void (*eval)(publish_request &), int workers) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if(!_threads.empty()) return;
+    _eval = eval;
+    for(int n = 0; n < std::max(workers, 1); n++) {
+        _threads.emplace_back(&publish_stage::run, this);
+    }
+}
+
+void vortex::publish_stage::push(std::string &&request, int fd) {
+
+    int hops = current_hops + 1;
+    if(hops > _max_hops) {
+        _dropped++;
+        cm_log::warning(cm_util::format("publish: hop limit %d reached, dropped: %s",
+            (int) _max_hops, request.c_str()));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _queue.push_back({ std::move(request), fd, hops, std::chrono::steady_clock::now() });
+    }
+    _cond.notify_one();
+}
+
+void vortex::publish_stage::stats(publish_stats &out) {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        out.depth = _queue.size();
+    }
+    out.processed = _processed.exchange(0);
+    out.dropped = _dropped.exchange(0);
+    out.total_us = _total_us.exchange(0);
+    out.max_us = _max_us.exchange(0);
+}
+
+void vortex::publish_stage::run() {
+
+    std::vector<publish_request> batch;
+
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            _cond.wait(guard, [this] { return _done || !_queue.empty(); });
+            if(_done) return;
+            batch.swap(_queue);
+        }
+
+        // requests this batch generates queue up for the next one
+        for(auto &r : batch) {
+            current_hops = r.hops;
+            _eval(r);
+
+            uint64_t us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - r.queued).count();
+            _processed++;
+            _total_us += us;
+            uint64_t max = _max_us;
+            while(us > max && !_max_us.compare_exchange_weak(max, us));
+        }
+        current_hops = 0;
+        batch.clear();
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PUBLISH_H
+#define __PUBLISH_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+
+namespace vortex {
+
+// a +key2 copy generated by a watch notification
+struct publish_request {
+    std::string request;
+    int fd;             // socket of the request that triggered it
+    int hops;           // publishes between it and a client request
+    std::chrono::steady_clock::time_point queued;
+};
+
+struct publish_stats {
+    uint64_t processed;
+    uint64_t dropped;       // over the hop limit
+    uint64_t total_us;      // queued to applied
+    uint64_t max_us;
+    size_t depth;
+};
+
+// publish requests run on their own worker, in batches, off the request
+// path. a chain of publishes is bounded by a hop count rather than by
+// throttling.
+class publish_stage {
+
+protected:
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<publish_request> _queue;
+    std::vector<std::thread> _threads;
+    bool _done = false;
+
+    void (*_eval)(publish_request &) = nullptr;
+    std::atomic<int> _max_hops;
+
+    std::atomic<uint64_t> _processed;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<uint64_t> _total_us;
+    std::atomic<uint64_t> _max_us;
+
+    void run();
+
+public:
+    publish_stage();
+    ~publish_stage();
+
+    // start workers that apply each request with eval
+    void start(void (*eval)(publish_request &), int workers = 1);
+
+    void set_max_hops(int hops) { _max_hops = hops; }
+    int get_max_hops() { return _max_hops; }
+
+    // queue a publish made while handling a request on this thread; it is
+    // one hop further from the client than that request
+    void push(std::string &&request, int fd);
+
+    // counters since the last call, which resets them
+    void stats(publish_stats &out);
+};
+
+extern publish_stage publisher;
+
+}
+
+#endif  // __PUBLISH_H
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RADIX_TREE_H
+#define __RADIX_TREE_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace vortex {
+
+// compressed trie keyed by string. match() visits the value of every
+// stored key that is a prefix of its argument in one walk down the tree,
+// so the cost depends on the argument's length, not on the number of keys.
+template<class T>
+class radix_tree {
+
+protected:
+    struct node {
+        std::string label;      // edge from the parent
+        std::map<unsigned char,std::unique_ptr<node>> children;
+        bool has_value = false;
+        T value;
+    };
+
+    node _root;
+    size_t _size = 0;
+
+    static size_t common(const std::string &key, size_t pos, const std::string &label) {
+        size_t n = 0;
+        while(pos + n < key.size() && n < label.size() && key[pos + n] == label[n]) n++;
+        return n;
+    }
+
+    // fold a valueless node into its only child
+    static void merge(node *n) {
+        std::unique_ptr<node> c = std::move(n->children.begin()->second);
+        n->children.clear();
+        n->label.append(c->label);
+        n->children = std::move(c->children);
+        n->has_value = c->has_value;
+        n->value = std::move(c->value);
+    }
+
+public:
+
+    // value stored at key, created if absent
+    T &insert(const std::string &key) {
+        node *n = &_root;
+        size_t pos = 0;
+
+        for(;;) {
+            if(pos == key.size()) break;
+
+            auto it = n->children.find((unsigned char) key[pos]);
+            if(it == n->children.end()) {
+                std::unique_ptr<node> c(new node);
+                c->label = key.substr(pos);
+                node *p = c.get();
+                n->children[(unsigned char) key[pos]] = std::move(c);
+                n = p;
+                break;
+            }
+
+            node *c = it->second.get();
+            size_t l = common(key, pos, c->label);
+            if(l < c->label.size()) {
+                // split the edge where key leaves it
+                std::unique_ptr<node> mid(new node);
+                mid->label = c->label.substr(0, l);
+                std::unique_ptr<node> old = std::move(it->second);
+                old->label.erase(0, l);
+                mid->children[(unsigned char) old->label[0]] = std::move(old);
+                it->second = std::move(mid);
+                c = it->second.get();
+            }
+            n = c;
+            pos += l;
+        }
+
+        if(!n->has_value) {
+            n->has_value = true;
+            _size++;
+        }
+        return n->value;
+    }
+
+    // value stored at exactly key, or nullptr
+    T *find(const std::string &key) {
+        node *n = &_root;
+        size_t pos = 0;
+        while(pos < key.size()) {
+            auto it = n->children.find((unsigned char) key[pos]);
+            if(it == n->children.end()) return nullptr;
+            node *c = it->second.get();
+            if(key.compare(pos, c->label.size(), c->label) != 0) return nullptr;
+            pos += c->label.size();
+            n = c;
+        }
+        return n->has_value ? &n->value : nullptr;
+    }
+
+    bool erase(const std::string &key) {
+        std::vector<node *> path;
+        node *n = &_root;
+        size_t pos = 0;
+        while(pos < key.size()) {
+            auto it = n->children.find((unsigned char) key[pos]);
+            if(it == n->children.end()) return false;
+            node *c = it->second.get();
+            if(key.compare(pos, c->label.size(), c->label) != 0) return false;
+            pos += c->label.size();
+            path.push_back(n);
+            n = c;
+        }
+        if(!n->has_value) return false;
+
+        n->has_value = false;
+        n->value = T();
+        _size--;
+
+        if(path.empty()) return true;   // root
+
+        node *parent = path.back();
+        if(n->children.empty()) {
+            parent->children.erase((unsigned char) n->label[0]);
+            // the parent may now be a valueless pass-through
+            if(path.size() > 1 && !parent->has_value && parent->children.size() == 1) {
+                merge(parent);
+            }
+        }
+        else if(n->children.size() == 1) {
+            merge(n);
+        }
+        return true;
+    }
+
+    // call f(value) for every stored key that is a prefix of key,
+    // shortest first
+    template<class F>
+    void match(const std::string &key, F f) {
+        node *n = &_root;
+        size_t pos = 0;
+        if(n->has_value) f(n->value);
+        while(pos < key.size()) {
+            auto it = n->children.find((unsigned char) key[pos]);
+            if(it == n->children.end()) return;
+            node *c = it->second.get();
+            if(key.compare(pos, c->label.size(), c->label) != 0) return;
+            pos += c->label.size();
+            n = c;
+            if(n->has_value) f(n->value);
+        }
+    }
+
+    size_t size() { return _size; }
+
+    void clear() {
+        _root.children.clear();
+        _root.has_value = false;
+        _root.value = T();
+        _size = 0;
+    }
+};
+
+}
+
+#endif  // __RADIX_TREE_H
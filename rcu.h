@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RCU_H
+#define __RCU_H
+
+#include <atomic>
+#include <thread>
+
+#include "util.h"
+
+namespace vortex {
+
+// epoch based read-copy-update domain
+//
+// readers announce themselves in one of two per-epoch counters and never
+// block; synchronize() advances the epoch and waits until every reader that
+// could still see the previous epoch has left. reader counters are spread
+// over cache line padded slots so readers on different threads do not
+// contend on the same line.
+
+class rcu_domain {
+
+protected:
+    static const int num_slots = 64;
+
+    struct alignas(64) slot {
+        std::atomic<long> readers[2];
+        slot() { readers[0] = 0; readers[1] = 0; }
+    };
+
+    std::atomic<unsigned long> _epoch;
+    slot _slots[num_slots];
+    cm::mutex _writer;
+
+    static int thread_slot() {
+        static std::atomic<int> next_slot(0);
+        thread_local int index = next_slot.fetch_add(1) % num_slots;
+        return index;
+    }
+
+    long readers(int phase) {
+        long n = 0;
+        for(int i = 0; i < num_slots; i++) n += _slots[i].readers[phase].load();
+        return n;
+    }
+
+public:
+    rcu_domain(): _epoch(0) {}
+
+    // returns the phase the reader entered, to be passed to read_unlock()
+    int read_lock() {
+        slot &s = _slots[thread_slot()];
+        for(;;) {
+            unsigned long e = _epoch.load();
+            int phase = (int) (e & 1);
+            s.readers[phase].fetch_add(1);
+            if(_epoch.load() == e) return phase;
+            // epoch moved while we announced; retry in the new phase
+            s.readers[phase].fetch_sub(1);
+        }
+    }
+
+    void read_unlock(int phase) {
+        _slots[thread_slot()].readers[phase].fetch_sub(1);
+    }
+
+    // wait until no reader can still hold a pointer read before this call
+    void synchronize() {
+        _writer.lock();
+        unsigned long e = _epoch.fetch_add(1);
+        int phase = (int) (e & 1);
+        while(readers(phase) != 0) {
+            std::this_thread::yield();
+        }
+        _writer.unlock();
+    }
+};
+
+}
+
+#endif  // __RCU_H
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "reactor.h"
+
+// input read from one socket per wakeup before it is handled
+static const size_t max_read_size = 1024 * 1024;
+
+std::mutex vortex::reactor::_sockets_mutex;
+std::unordered_set<int> vortex::reactor::_sockets;
+
+vortex::reactor::reactor(int index, int port, void (*handler)(void *), void (*dealloc)(void *), int cpu):
+    _index(index), _port(port), _cpu(cpu), _done(false), _handler(handler), _dealloc(dealloc),
+    _buf(64 * 1024) {}
+
+vortex::reactor::~reactor() {
+    stop();
+}
+
+bool vortex::reactor::start() {
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(_listen_fd == -1) {
+        cm_net::err("reactor: socket", errno);
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        cm_net::err("reactor: SO_REUSEPORT", errno);
+        return false;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_port);
+
+    if(bind(_listen_fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+        cm_net::err("reactor: bind", errno);
+        return false;
+    }
+    if(listen(_listen_fd, SOMAXCONN) != 0) {
+        cm_net::err("reactor: listen", errno);
+        return false;
+    }
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(_epoll_fd == -1) {
+        cm_net::err("reactor: epoll_create1", errno);
+        return false;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _listen_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+
+    _thread = std::thread(&reactor::run, this);
+
+    if(_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_cpu, &cpus);
+        int rc = pthread_setaffinity_np(_thread.native_handle(), sizeof(cpus), &cpus);
+        if(rc != 0) cm_net::err("reactor: pthread_setaffinity_np", rc);
+    }
+
+    cm_log::info(cm_util::format("reactor %d: listening on port %d%s", _index, _port,
+        _cpu >= 0 ? cm_util::format(", cpu %d", _cpu).c_str() : ""));
+    return true;
+}
+
+void vortex::reactor::stop() {
+    _done = true;
+    if(_thread.joinable()) _thread.join();
+    if(_epoll_fd != -1) close(_epoll_fd);
+    if(_listen_fd != -1) close(_listen_fd);
+    _epoll_fd = _listen_fd = -1;
+}
+
+void vortex::reactor::run() {
+
+    epoll_event events[256];
+
+    while(!_done) {
+        // wake now and then to notice stop()
+        int n = epoll_wait(_epoll_fd, events, 256, 500);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            cm_net::err("reactor: epoll_wait", errno);
+            break;
+        }
+
+        for(int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if(fd == _listen_fd) {
+                accept_all();
+            }
+            else {
+                read_all(fd);
+            }
+        }
+    }
+}
+
+void vortex::reactor::accept_all() {
+    for(;;) {
+        int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) cm_net::err("reactor: accept", errno);
+            return;
+        }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            cm_net::err("reactor: epoll_ctl", errno);
+            close(fd);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_sockets_mutex);
+            _sockets.insert(fd);
+        }
+
+        cm_net::input_event *event = new cm_net::input_event(fd, std::string());
+        event->connect = true;
+        dispatch(event);
+    }
+}
+
+void vortex::reactor::read_all(int fd) {
+
+    std::string msg;
+    bool eof = false;
+
+    while(msg.size() < max_read_size) {
+        ssize_t n = read(fd, _buf.data(), _buf.size());
+        if(n > 0) {
+            msg.append(_buf.data(), n);
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        eof = true;
+        break;
+    }
+
+    if(msg.size() > 0) {
+        dispatch(new cm_net::input_event(fd, msg));
+    }
+
+    // level triggered: anything left past max_read_size wakes us again
+    if(eof) disconnect(fd);
+}
+
+void vortex::reactor::disconnect(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+    cm_net::input_event *event = new cm_net::input_event(fd, std::string());
+    event->eof = true;
+    dispatch(event);
+
+    // the eof may only be queued behind a busy strand; the server closes
+    // the socket with release() once it has forgotten it, so its number
+    // is not reused while events or state of this client remain
+}
+
+void vortex::reactor::release(int fd) {
+    {
+        std::lock_guard<std::mutex> guard(_sockets_mutex);
+        if(_sockets.erase(fd) == 0) return;
+    }
+    close(fd);
+}
+
+void vortex::reactor::dispatch(cm_net::input_event *event) {
+    _handler(event);
+    _dealloc(event);
+}
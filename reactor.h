@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __REACTOR_H
+#define __REACTOR_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+
+#include "log.h"
+#include "network.h"
+
+namespace vortex {
+
+// one epoll event loop with its own listening socket. several reactors
+// bind the same port with SO_REUSEPORT and the kernel spreads incoming
+// connections over them. a connection stays on the reactor that accepted
+// it, and its requests run on that reactor's thread unless the handler
+// hands them off (as the server does when journal writes block).
+class reactor {
+
+protected:
+    int _index;
+    int _port;
+    int _cpu;
+    int _listen_fd = -1;
+    int _epoll_fd = -1;
+    std::thread _thread;
+    std::atomic<bool> _done;
+
+    // called with each event, as pool_server would from the pool
+    void (*_handler)(void *);
+    void (*_dealloc)(void *);
+
+    std::vector<char> _buf;
+
+    // sockets accepted by any reactor and not yet released
+    static std::mutex _sockets_mutex;
+    static std::unordered_set<int> _sockets;
+
+    void run();
+    void accept_all();
+    void read_all(int fd);
+    void dispatch(cm_net::input_event *event);
+    void disconnect(int fd);
+
+public:
+    reactor(int index, int port, void (*handler)(void *), void (*dealloc)(void *), int cpu = -1);
+    ~reactor();
+
+    // open the listener and start the event loop thread
+    bool start();
+    void stop();
+
+    // close a reactor's socket once the server has handled its eof and
+    // forgotten it; sockets of other origins are left alone
+    static void release(int fd);
+};
+
+}
+
+#endif  // __REACTOR_H
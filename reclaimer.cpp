@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+
+#include "reclaimer.h"
+
+vortex::reclaimer vortex::store_reclaimer;
+
+namespace {
+
+class node_garbage: public vortex::garbage {
+    std::vector<vortex::entry_node> _nodes;
+    size_t _entries;
+public:
+    node_garbage(std::vector<vortex::entry_node> &&nodes):
+        _nodes(std::move(nodes)), _entries(_nodes.size()) {}
+
+    bool reclaim(size_t chunk) {
+        for(size_t n = 0; n < chunk && !_nodes.empty(); n++) {
+            _nodes.pop_back();
+        }
+        if(_nodes.empty()) {
+            std::vector<vortex::entry_node>().swap(_nodes);
+            return false;
+        }
+        return true;
+    }
+
+    size_t entries() { return _entries; }
+    const char *name() { return "evicted"; }
+};
+
+}
+
+vortex::reclaimer::~reclaimer() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    _cond.notify_one();
+    if(_thread.joinable()) _thread.join();
+    for(auto g: _queue) delete g;
+}
+
+void vortex::reclaimer::retire(std::vector<entry_node> &&nodes) {
+    if(nodes.empty()) return;
+    retire(new node_garbage(std::move(nodes)));
+}
+
+void vortex::reclaimer::retire(garbage *g) {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _queue.push_back(g);
+        if(!_thread.joinable()) {
+            _thread = std::thread(&reclaimer::run, this);
+        }
+    }
+    _cond.notify_one();
+}
+
+void vortex::reclaimer::run() {
+
+    for(;;) {
+        garbage *g = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            _cond.wait(guard, [this] { return _done || !_queue.empty(); });
+            if(_done) return;
+            g = _queue.front();
+            _queue.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        // free in bounded chunks, yielding in between so the reclaimer
+        // never holds a shard or the allocator for long
+        while(g->reclaim(_chunk)) {
+            std::this_thread::yield();
+        }
+
+        long ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        cm_log::info(cm_util::format("reclaim: %s: %lu entries in %ld ms",
+            g->name(), g->entries(), ms));
+
+        delete g;
+    }
+}
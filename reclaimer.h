@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RECLAIMER_H
+#define __RECLAIMER_H
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+#include "shard_store.h"
+
+namespace vortex {
+
+// memory retired from the store, freed a chunk at a time
+class garbage {
+public:
+    virtual ~garbage() {}
+
+    // free up to chunk entries; return false when nothing is left
+    virtual bool reclaim(size_t chunk) = 0;
+    virtual size_t entries() = 0;
+    virtual const char *name() = 0;
+};
+
+// frees retired memory on a background thread so request and rotation
+// paths only ever hand off pointers
+class reclaimer {
+
+protected:
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<garbage *> _queue;
+    std::thread _thread;
+    bool _done = false;
+    size_t _chunk;
+
+    void run();
+
+public:
+    reclaimer(size_t chunk = 1024): _chunk(chunk) {}
+    ~reclaimer();
+
+    // take ownership of nodes evicted from the store
+    void retire(std::vector<entry_node> &&nodes);
+
+    void retire(garbage *g);
+};
+
+extern reclaimer store_reclaimer;
+
+}
+
+#endif  // __RECLAIMER_H
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+
+#include "record.h"
+
+const char vortex::journal_magic[6] = { 'V', 'X', 'J', 'R', 'N', 'L' };
+
+namespace {
+
+struct crc_table {
+    uint32_t t[256];
+    crc_table() {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+            }
+            t[i] = c;
+        }
+    }
+};
+
+void put16(char *p, uint16_t v) {
+    for(int i = 0; i < 2; i++) p[i] = (char) (v >> (8 * i));
+}
+
+void put32(char *p, uint32_t v) {
+    for(int i = 0; i < 4; i++) p[i] = (char) (v >> (8 * i));
+}
+
+void put64(char *p, uint64_t v) {
+    for(int i = 0; i < 8; i++) p[i] = (char) (v >> (8 * i));
+}
+
+uint32_t get32(const char *p) {
+    uint32_t v = 0;
+    for(int i = 3; i >= 0; i--) v = (v << 8) | (uint8_t) p[i];
+    return v;
+}
+
+uint64_t get64(const char *p) {
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = (v << 8) | (uint8_t) p[i];
+    return v;
+}
+
+}
+
+uint32_t vortex::crc32(const void *buf, size_t len, uint32_t crc) {
+    static const crc_table table;
+    const uint8_t *p = (const uint8_t *) buf;
+    crc = ~crc;
+    while(len--) {
+        crc = table.t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void vortex::encode_journal_header(std::string &out) {
+    out.append(journal_magic, sizeof(journal_magic));
+    out.push_back((char) journal_version);
+    out.push_back('\0');
+}
+
+bool vortex::is_journal_header(const char *buf, size_t len) {
+    return len >= journal_header_size &&
+        memcmp(buf, journal_magic, sizeof(journal_magic)) == 0 &&
+        (uint8_t) buf[6] == journal_version;
+}
+
+void vortex::encode_record_header(char *h, uint8_t op, uint8_t flags, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires) {
+
+    char tail[expiry_size];
+    size_t tail_len = 0;
+    if(expires > 0) {
+        flags |= record_expires;
+        encode_expiry(tail, expires);
+        tail_len = expiry_size;
+    }
+    else {
+        flags &= ~record_expires;
+    }
+
+    h[0] = (char) op;
+    h[1] = (char) flags;
+    put16(h + 2, 0);
+    put64(h + 4, seq);
+    put64(h + 12, timestamp);
+    put32(h + 20, (uint32_t) key_len);
+    put32(h + 24, (uint32_t) (value_len + tail_len));
+    put32(h + 28, 0);
+
+    uint32_t crc = crc32(h, record_header_size);
+    crc = crc32(key, key_len, crc);
+    crc = crc32(value, value_len, crc);
+    crc = crc32(tail, tail_len, crc);
+    put32(h + 28, crc);
+}
+
+void vortex::encode_expiry(char *p, uint64_t expires) {
+    put64(p, expires);
+}
+
+void vortex::encode_record(std::string &out, uint8_t op, uint8_t flags, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires) {
+
+    char h[record_header_size];
+    encode_record_header(h, op, flags, seq, timestamp, key, key_len, value, value_len, expires);
+    out.append(h, sizeof(h));
+    out.append(key, key_len);
+    out.append(value, value_len);
+    if(expires > 0) {
+        char tail[expiry_size];
+        encode_expiry(tail, expires);
+        out.append(tail, sizeof(tail));
+    }
+}
+
+bool vortex::peek_record_seq(const char *buf, size_t len, uint64_t &seq) {
+    if(len < record_header_size) return false;
+    seq = get64(buf + 4);
+    return true;
+}
+
+size_t vortex::decode_record(const char *buf, size_t len, record_view &r) {
+
+    if(len < record_header_size) return 0;
+
+    uint32_t key_len = get32(buf + 20);
+    uint32_t value_len = get32(buf + 24);
+    uint64_t total = (uint64_t) record_header_size + key_len + value_len;
+    if(total > len) return 0;
+
+    char h[record_header_size];
+    memcpy(h, buf, sizeof(h));
+    put32(h + 28, 0);
+
+    uint32_t crc = crc32(h, sizeof(h));
+    crc = crc32(buf + record_header_size, key_len + value_len, crc);
+    if(crc != get32(buf + 28)) return 0;
+
+    r.op = (uint8_t) buf[0];
+    r.flags = (uint8_t) buf[1];
+    r.seq = get64(buf + 4);
+    r.timestamp = get64(buf + 12);
+    r.key = buf + record_header_size;
+    r.key_len = key_len;
+    r.value = r.key + key_len;
+    r.value_len = value_len;
+    r.expires = 0;
+    if((r.flags & record_expires) && value_len >= expiry_size) {
+        r.value_len -= expiry_size;
+        r.expires = get64(r.value + r.value_len);
+    }
+
+    return (size_t) total;
+}
+
+uint32_t vortex::instance_id(const std::string &name) {
+    uint32_t h = 2166136261U;
+    for(unsigned char c : name) {
+        h ^= c;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+void vortex::encode_frame(std::string &out, const origin &o, uint8_t op, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires) {
+
+    char h[frame_header_size];
+    h[0] = (char) frame_magic;
+    h[1] = (char) o.hops;
+    put16(h + 2, 0);
+    for(size_t i = 0; i < max_origin_hops; i++) {
+        put32(h + 4 + 4 * i, i < o.hops ? o.ids[i] : 0);
+    }
+    out.append(h, sizeof(h));
+    encode_record(out, op, 0, seq, timestamp, key, key_len, value, value_len, expires);
+}
+
+size_t vortex::decode_frame(const char *buf, size_t len, origin &o, record_view &r, bool &corrupt) {
+
+    corrupt = false;
+    if(len < frame_header_size + record_header_size) return 0;
+
+    const char *rec = buf + frame_header_size;
+    uint64_t total = (uint64_t) record_header_size + get32(rec + 20) + get32(rec + 24);
+    if(len - frame_header_size < total) return 0;
+
+    uint8_t hops = (uint8_t) buf[1];
+    size_t n = decode_record(rec, (size_t) total, r);
+    if((uint8_t) buf[0] != frame_magic || hops > max_origin_hops || n == 0) {
+        corrupt = true;
+        return 0;
+    }
+
+    o.hops = hops;
+    for(size_t i = 0; i < max_origin_hops; i++) {
+        o.ids[i] = get32(buf + 4 + 4 * i);
+    }
+    return frame_header_size + n;
+}
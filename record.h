@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RECORD_H
+#define __RECORD_H
+
+#include <cstdint>
+#include <string>
+
+namespace vortex {
+
+// binary journal file layout:
+//
+//   file header:  "VXJRNL" version(u8) reserved(u8)
+//   record:       op(u8) flags(u8) reserved(u16) seq(u64) timestamp_ms(u64)
+//                 key_len(u32) value_len(u32) crc32(u32) key value
+//
+// all integers are little endian. the crc covers the record header (with
+// the crc field taken as zero) plus key and value, so a torn or corrupt
+// tail is detected when the crc or the lengths do not check out.
+//
+// a record with the record_expires flag holds a key with a ttl: its value
+// is followed by the expiry time, expires_ms(u64) since the epoch, which
+// value_len includes. decoding takes it off the value again.
+
+const size_t journal_header_size = 8;
+const size_t record_header_size = 32;
+const uint8_t journal_version = 2;
+
+const uint8_t record_expires = 0x01;
+const size_t expiry_size = 8;
+
+extern const char journal_magic[6];
+
+struct record_view {
+    uint8_t op = 0;
+    uint8_t flags = 0;
+    uint64_t seq = 0;
+    uint64_t timestamp = 0;     // ms since epoch
+    const char *key = nullptr;
+    uint32_t key_len = 0;
+    const char *value = nullptr;
+    uint32_t value_len = 0;
+    uint64_t expires = 0;       // ms since epoch; 0 if the key has no ttl
+};
+
+uint32_t crc32(const void *buf, size_t len, uint32_t crc = 0);
+
+void encode_journal_header(std::string &out);
+// true for the header of a journal of this version
+bool is_journal_header(const char *buf, size_t len);
+
+// encode a record header (record_header_size bytes) for key and value;
+// with expires set, the caller writes the expiry (see encode_expiry)
+// after the value
+void encode_record_header(char *h, uint8_t op, uint8_t flags, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires = 0);
+
+// the expiry_size bytes that follow the value of a record with a ttl
+void encode_expiry(char *p, uint64_t expires);
+
+// append an encoded record to out
+void encode_record(std::string &out, uint8_t op, uint8_t flags, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires = 0);
+
+// sequence number from a record header, without checking the record
+bool peek_record_seq(const char *buf, size_t len, uint64_t &seq);
+
+// decode the record at buf; returns bytes consumed, or 0 if the record is
+// incomplete or fails its checksum (torn tail)
+size_t decode_record(const char *buf, size_t len, record_view &r);
+
+// replication frame: a record behind a fixed-size origin header
+//
+//   frame:  magic(u8) hops(u8) reserved(u16) origin(u32 x max_origin_hops)
+//           record
+//
+// origin lists the instance ids of the servers a mutation has passed
+// through, the one it was made on first; unused slots are zero. a frame
+// is told apart from a text request by its first byte.
+
+const uint8_t frame_magic = 0x02;
+const size_t max_origin_hops = 8;
+const size_t frame_header_size = 4 + 4 * max_origin_hops;
+
+struct origin {
+    uint8_t hops = 0;
+    uint32_t ids[max_origin_hops] = {};
+
+    bool contains(uint32_t id) const {
+        for(size_t i = 0; i < hops; i++) {
+            if(ids[i] == id) return true;
+        }
+        return false;
+    }
+
+    // false if the mutation has made max_origin_hops hops already
+    bool add(uint32_t id) {
+        if(hops >= max_origin_hops) return false;
+        ids[hops++] = id;
+        return true;
+    }
+};
+
+// instance id of a server name (fnv-1a)
+uint32_t instance_id(const std::string &name);
+
+// append a frame holding one record to out
+void encode_frame(std::string &out, const origin &o, uint8_t op, uint64_t seq,
+    uint64_t timestamp, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires = 0);
+
+// decode the frame at buf; returns bytes consumed, or 0 if the frame is
+// incomplete or, with corrupt set, fails its checks
+size_t decode_frame(const char *buf, size_t len, origin &o, record_view &r, bool &corrupt);
+
+}
+
+#endif  // __RECORD_H
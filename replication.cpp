@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <sys/socket.h>
+
+#include "replication.h"
+#include "output.h"
+#include "storage.h"
+
+vortex::replicator vortex::replication;
+
+// most log entries sent to a peer at once
+static const size_t max_batch_entries = 4096;
+
+// batches queued on a peer's socket before the sender waits for it
+static const size_t max_peer_depth = 16;
+
+// a peer this far behind is disconnected rather than holding the log
+static const size_t max_log_entries = 1024 * 1024;
+
+// bytes a resync writes to a peer at once
+static const size_t resync_chunk = 1024 * 1024;
+
+static uint64_t now_ms() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// append a frame for one mutation with our id added to its origin; false
+// if it has made too many hops to go further
+static bool append_frame(std::string &out, vortex::origin o, uint32_t own, uint8_t op,
+    uint64_t seq, uint64_t ms, const char *key, size_t key_len, const char *value, size_t value_len,
+    uint64_t expires) {
+    if(!o.add(own)) return false;
+    vortex::encode_frame(out, o, op, seq, ms, key, key_len, value, value_len, expires);
+    return true;
+}
+
+static std::string throughput(size_t records, size_t bytes, long ms) {
+    double secs = ms > 0 ? ms / 1000.0 : 0.001;
+    return cm_util::format("%lu records, %lu bytes in %ld ms (%.0f records/s, %.1f MB/s)",
+        records, bytes, ms, records / secs, bytes / secs / (1024.0 * 1024.0));
+}
+
+vortex::replicator::replicator(): _num_peers(0) {
+    _epoch = (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+vortex::replicator::~replicator() {
+    {
+        std::unique_lock<std::mutex> guard(_mutex);
+        _done = true;
+        _cond.notify_all();
+        _cond.wait(guard, [this] { return _resyncs == 0; });
+    }
+    if(_thread.joinable()) _thread.join();
+}
+
+void vortex::replicator::set_sequence(uint64_t seq) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _seq = seq;
+    _log_from = seq;
+}
+
+void vortex::replicator::add_peer(int fd, bool resume, uint64_t from, uint64_t epoch) {
+
+    uint64_t upto;
+    bool syncing;
+
+    // sequence numbers from before our restart may be reused since; a
+    // peer that applied them is sent the whole store
+    bool full = resume && epoch != _epoch;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        upto = _seq;
+
+        // the log covers a peer that resumes within it; anything else
+        // (including a peer ahead of us) is brought up to upto first
+        syncing = resume && (full || from < _log_from || from > _seq);
+        uint64_t start = resume && !syncing ? from : _seq;
+        _peers[fd] = { start, start, syncing };
+        _num_peers = _peers.size();
+        if(syncing) _resyncs++;
+        if(!_thread.joinable()) {
+            _thread = std::thread(&replicator::run, this);
+        }
+    }
+    _cond.notify_all();
+
+    if(syncing) {
+        cm_log::info(cm_util::format("%d: replication peer resync from seq %llu%s to %llu",
+            fd, (unsigned long long) from, full ? " of another epoch" : "", (unsigned long long) upto));
+        std::thread(&replicator::resync, this, fd, from, upto, full).detach();
+    }
+    else if(resume) {
+        cm_log::info(cm_util::format("%d: replication peer resumed at seq %llu", fd, (unsigned long long) from));
+    }
+    else {
+        cm_log::info(cm_util::format("%d: replication peer added at seq %llu", fd, (unsigned long long) upto));
+    }
+}
+
+void vortex::replicator::remove_peer(int fd) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if(_peers.erase(fd) == 0) return;
+    _num_peers = _peers.size();
+    trim();
+    cm_log::warning(cm_util::format("%d: replication peer removed", fd));
+}
+
+bool vortex::replicator::is_peer(int fd) {
+    if(_num_peers == 0) return false;
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _peers.count(fd) > 0;
+}
+
+void vortex::replicator::publish(std::vector<mutation> &batch) {
+    if(batch.empty()) return;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _seq = batch.back().seq;
+        if(_peers.empty()) {
+            _log_from = _seq;
+            return;
+        }
+        uint64_t ms = now_ms();
+        for(auto &m : batch) {
+            _log.push_back({ m.seq, ms, std::string() });
+            if(!append_frame(_log.back().data, m.origin, _instance, (uint8_t) m.op, m.seq,
+                m.millis, m.name.data(), m.name.size(), m.value.data(), m.value.size(), m.expires)) {
+                CM_LOG_TRACE {
+                    cm_log::trace(cm_util::format("replication: %s: hop limit reached", m.name.c_str()));
+                }
+                _log.pop_back();
+            }
+        }
+
+        // a stalled peer never acknowledges, so the limit is enforced here
+        if(_log.size() > max_log_entries) trim();
+    }
+    _cond.notify_all();
+}
+
+void vortex::replicator::ack(int fd, uint64_t seq) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto it = _peers.find(fd);
+    if(it == _peers.end()) return;
+    if(seq > it->second.acked_seq && seq <= it->second.sent_seq) {
+        it->second.acked_seq = seq;
+        trim();
+    }
+}
+
+uint64_t vortex::replicator::get_sequence() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _seq;
+}
+
+size_t vortex::replicator::find(uint64_t seq) {
+    // sequence numbers ascend but may skip a batch the journal failed to write
+    auto it = std::partition_point(_log.begin(), _log.end(),
+        [seq](const entry &e) { return e.seq <= seq; });
+    return (size_t) (it - _log.begin());
+}
+
+// drop entries every peer has acknowledged; called locked
+void vortex::replicator::trim() {
+    uint64_t acked = _seq;
+    for(auto &it : _peers) acked = std::min(acked, it.second.acked_seq);
+    while(!_log.empty() && _log.front().seq <= acked) {
+        _log_from = _log.front().seq;
+        _log.pop_front();
+    }
+    if(_log.empty()) _log_from = _seq;
+
+    if(_log.size() <= max_log_entries) return;
+
+    // the slowest peers would keep too much; they reconnect and catch up
+    uint64_t keep = _log.back().seq - max_log_entries;
+    for(auto it = _peers.begin(); it != _peers.end();) {
+        if(it->second.acked_seq < keep) {
+            cm_log::warning(cm_util::format("%d: replication peer %llu behind, disconnecting",
+                it->first, (unsigned long long) (_seq - it->second.acked_seq)));
+            shutdown(it->first, SHUT_RDWR);
+            it = _peers.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+    _num_peers = _peers.size();
+    trim();
+}
+
+void vortex::replicator::stats(std::vector<peer_stats> &out) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    uint64_t now = now_ms();
+    for(auto &it : _peers) {
+        const peer &p = it.second;
+        uint64_t lag_ms = 0;
+        size_t index = find(p.acked_seq);
+        if(p.acked_seq < _seq && index < _log.size()) {
+            const entry &e = _log[index];
+            lag_ms = now > e.ms ? now - e.ms : 0;
+        }
+        out.push_back({ it.first, p.sent_seq, p.acked_seq, _seq - p.acked_seq, lag_ms, p.syncing });
+    }
+}
+
+bool vortex::replicator::resync_write(int fd, const std::string &buf) {
+
+    // hold back while the peer's socket is full, as the sender does
+    for(;;) {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if(_done || _peers.count(fd) == 0) return false;
+        }
+        if(backlog.depth(fd) < max_peer_depth) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    backlog.write(fd, buf.c_str(), buf.size());
+    return true;
+}
+
+void vortex::replicator::resync(int fd, uint64_t from, uint64_t upto, bool full) {
+
+    auto start = std::chrono::steady_clock::now();
+    size_t records = 0;
+    size_t bytes = 0;
+    bool ok = true;
+    std::string buf;
+
+    auto flush = [&]() {
+        if(ok && !buf.empty()) {
+            ok = resync_write(fd, buf);
+            bytes += buf.size();
+        }
+        buf.clear();
+    };
+
+    // the journal tail when the retained journals still hold it
+    const char *source = "journal";
+    bool tail = !full && from < upto && vortex::read_journal_tail(from, upto,
+        [&](const vortex::record_view &r) {
+            if(!ok) return;
+            append_frame(buf, vortex::origin(), _instance, r.op, r.seq, r.timestamp,
+                r.key, r.key_len, r.value, r.value_len, r.expires);
+            records++;
+            if(buf.size() >= resync_chunk) flush();
+        });
+
+    // otherwise a copy of the store, one shard at a time; it holds every
+    // change up to upto, and the log replays whatever it also picks up
+    // after that. the peer drops whatever keys the copy does not send
+    if(!tail && ok) {
+        source = "store";
+        flush();
+        buf.append("$:RESYNC\n");
+        vortex::shard_store *store = vortex::mem_store;
+        for(size_t i = 0; ok && i < store->shards(); i++) {
+            store->visit(i, [&](const std::string &key, const vortex::entry &e) {
+                append_frame(buf, vortex::origin(), _instance, '+', upto, 0,
+                    key.data(), key.size(), e.value.data(), e.value.size(), e.expires);
+                records++;
+            });
+            flush();
+        }
+    }
+
+    // the peer acknowledges upto and joins the log stream after it
+    buf.append(cm_util::format("$:REPL %llu %llu %llu\n", (unsigned long long) upto,
+        (unsigned long long) now_ms(), (unsigned long long) _epoch));
+    flush();
+
+    long ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    if(ok) {
+        cm_log::info(cm_util::format("%d: replication resync from %s to seq %llu: %s",
+            fd, source, (unsigned long long) upto, throughput(records, bytes, ms).c_str()));
+    }
+    else {
+        cm_log::warning(cm_util::format("%d: replication resync from %s abandoned after %s",
+            fd, source, throughput(records, bytes, ms).c_str()));
+    }
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto it = _peers.find(fd);
+    if(it != _peers.end()) it->second.syncing = false;
+    _resyncs--;
+    _cond.notify_all();
+}
+
+void vortex::replicator::run() {
+
+    std::vector<std::pair<int,std::string>> batches;
+
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+
+            // peers held back by a full socket are retried shortly
+            _cond.wait_for(guard, std::chrono::milliseconds(10), [this] {
+                if(_done) return true;
+                for(auto &it : _peers) {
+                    if(!it.second.syncing && it.second.sent_seq < _seq &&
+                        backlog.depth(it.first) < max_peer_depth) return true;
+                }
+                return false;
+            });
+            if(_done) return;
+
+            for(auto &it : _peers) {
+                peer &p = it.second;
+                if(p.syncing || p.sent_seq >= _seq) continue;
+                if(backlog.depth(it.first) >= max_peer_depth) continue;
+
+                size_t first = find(p.sent_seq);
+                size_t last = std::min(_log.size(), first + max_batch_entries);
+                if(first >= last) {
+                    // nothing logged after sent_seq (skipped sequence numbers)
+                    p.sent_seq = _seq;
+                    continue;
+                }
+
+                std::string buf;
+                for(size_t i = first; i < last; i++) {
+                    buf.append(_log[i].data);
+                }
+                p.sent_seq = _log[last - 1].seq;
+                buf.append(cm_util::format("$:REPL %llu %llu %llu\n",
+                    (unsigned long long) p.sent_seq, (unsigned long long) _log[last - 1].ms,
+                    (unsigned long long) _epoch));
+                batches.emplace_back(it.first, std::move(buf));
+            }
+        }
+
+        // one write per peer per batch, outside the lock
+        for(auto &b : batches) {
+            backlog.write(b.first, b.second.c_str(), b.second.size());
+        }
+        batches.clear();
+    }
+}
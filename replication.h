@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __REPLICATION_H
+#define __REPLICATION_H
+
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+#include "record.h"
+
+namespace vortex {
+
+struct peer_stats {
+    int fd;
+    uint64_t sent_seq;
+    uint64_t acked_seq;
+    uint64_t lag_seq;       // mutations not yet acknowledged
+    uint64_t lag_ms;        // age of the oldest unacknowledged mutation
+    bool syncing;           // catching up from the journal or the store
+};
+
+// one journaled mutation handed over by the journal writer
+struct mutation {
+    uint64_t seq;               // journal sequence number
+    uint64_t millis;
+    char op;
+    std::string name;
+    std::string value;
+    vortex::origin origin;      // servers it came through
+    uint64_t expires;           // expiry of a key with a ttl, or 0
+};
+
+// asynchronous replication to any number of peers. each journaled
+// mutation goes into a log as a binary frame (see record.h) under its
+// journal sequence number, with our instance id added to its origin; a
+// mutation whose origin already holds a peer's id has looped and is
+// dropped there. a sender thread streams the log to every peer in
+// batches, each batch followed by a marker line
+//
+//   $:REPL <last seq> <ms> <epoch>
+//
+// which the peer answers with $:ACK <seq> once the batch is applied. the
+// request path only appends to the log. the epoch is fixed when this
+// server starts: sequence numbers are only comparable within one epoch.
+//
+// a peer that reconnects sends the last sequence number it applied and
+// the epoch it was in. from another epoch it gets a copy of the store;
+// otherwise, if the log still holds everything after it, streaming resumes there;
+// otherwise a resync thread sends the missing journal tail, or a copy of
+// the store if the journals no longer reach back that far, and the peer
+// joins the log stream after the sequence number the resync ended at. a
+// copy starts with a $:RESYNC line; the peer then removes every key it
+// held that the copy, ended by its $:REPL line, did not send.
+class replicator {
+
+protected:
+    struct entry {
+        uint64_t seq;
+        uint64_t ms;
+        std::string data;
+    };
+
+    struct peer {
+        uint64_t sent_seq;
+        uint64_t acked_seq;
+        bool syncing;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<entry> _log;     // from the oldest unacknowledged entry
+    uint64_t _seq = 0;          // last sequence number published
+    uint64_t _log_from = 0;     // _log holds every mutation after this
+    std::map<int,peer> _peers;
+    std::atomic<size_t> _num_peers;
+    std::thread _thread;
+    bool _done = false;
+    int _resyncs = 0;           // running resync threads
+    uint32_t _instance = 0;
+    uint64_t _epoch;            // start time, in ms since epoch
+
+    void run();
+    void trim();
+
+    // first log entry after seq; called locked
+    size_t find(uint64_t seq);
+
+    // send the mutations in (from, upto] to a syncing peer; a copy of the
+    // store when full is set
+    void resync(int fd, uint64_t from, uint64_t upto, bool full);
+
+    // write a resync chunk once the peer's socket has room; false if the
+    // peer is gone
+    bool resync_write(int fd, const std::string &buf);
+
+public:
+    replicator();
+    ~replicator();
+
+    // our instance id, added to the origin of every replicated mutation
+    void set_instance(uint32_t id) { _instance = id; }
+
+    // journal sequence number recovered at startup
+    void set_sequence(uint64_t seq);
+
+    // stream mutations to fd: after the current sequence number, or after
+    // from when resume is set (a reconnecting peer) and epoch is ours
+    void add_peer(int fd, bool resume = false, uint64_t from = 0, uint64_t epoch = 0);
+    void remove_peer(int fd);
+    bool has_peers() { return _num_peers > 0; }
+    bool is_peer(int fd);
+
+    // append a batch of journaled mutations to the stream
+    void publish(std::vector<mutation> &batch);
+
+    void ack(int fd, uint64_t seq);
+
+    uint64_t get_sequence();
+    uint64_t get_epoch() { return _epoch; }
+
+    void stats(std::vector<peer_stats> &out);
+};
+
+extern replicator replication;
+
+}
+
+#endif  // __REPLICATION_H
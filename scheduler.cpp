@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+
+#include "scheduler.h"
+
+vortex::scheduler vortex::tasks;
+
+// index of the worker running on this thread, or -1
+static thread_local int current_worker = -1;
+
+vortex::scheduler::~scheduler() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _done = true;
+    }
+    _cond.notify_all();
+    for(auto &w : _workers) {
+        if(w->thread.joinable()) w->thread.join();
+    }
+}
+
+void vortex::scheduler::start(int threads) {
+    if(started() || threads <= 0) return;
+
+    for(int n = 0; n < threads; n++) {
+        _workers.emplace_back(new worker());
+    }
+    for(size_t n = 0; n < _workers.size(); n++) {
+        _workers[n]->thread = std::thread(&scheduler::run, this, n);
+    }
+    cm_log::info(cm_util::format("scheduler: %d workers", threads));
+}
+
+void vortex::scheduler::submit(void (*fn)(void *), void *arg, void (*dealloc)(void *)) {
+
+    size_t index = current_worker >= 0 ? (size_t) current_worker :
+        _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+
+    worker &w = *_workers[index];
+    {
+        std::lock_guard<std::mutex> guard(w.mutex);
+        w.tasks.push_back({ fn, arg, dealloc });
+    }
+
+    // pairs with the check a worker makes before it sleeps
+    _pending++;
+    if(_sleeping > 0) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _cond.notify_one();
+    }
+}
+
+bool vortex::scheduler::pop(size_t index, task &t) {
+    worker &w = *_workers[index];
+    std::lock_guard<std::mutex> guard(w.mutex);
+    if(w.tasks.empty()) return false;
+    t = w.tasks.front();
+    w.tasks.pop_front();
+    return true;
+}
+
+bool vortex::scheduler::steal(size_t index, task &t) {
+    size_t n = _workers.size();
+    for(size_t i = 1; i < n; i++) {
+        worker &w = *_workers[(index + i) % n];
+        std::lock_guard<std::mutex> guard(w.mutex);
+        if(w.tasks.empty()) continue;
+        t = w.tasks.front();
+        w.tasks.pop_front();
+        _workers[index]->stolen++;
+        return true;
+    }
+    return false;
+}
+
+void vortex::scheduler::run(size_t index) {
+
+    current_worker = (int) index;
+    worker &self = *_workers[index];
+
+    for(;;) {
+        task t;
+        if(pop(index, t) || steal(index, t)) {
+            _pending--;
+
+            auto start = std::chrono::steady_clock::now();
+            t.fn(t.arg);
+            if(nullptr != t.dealloc) t.dealloc(t.arg);
+
+            self.busy_us += (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            self.executed++;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(_mutex);
+        _sleeping++;
+        _cond.wait(guard, [this] { return _done || _pending > 0; });
+        _sleeping--;
+        if(_done) return;
+    }
+}
+
+void vortex::scheduler::stats(std::vector<worker_stats> &out) {
+    for(auto &w : _workers) {
+        size_t depth;
+        {
+            std::lock_guard<std::mutex> guard(w->mutex);
+            depth = w->tasks.size();
+        }
+        out.push_back({ depth, w->executed, w->stolen, w->busy_us });
+    }
+}
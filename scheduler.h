@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.h"
+
+namespace vortex {
+
+struct task {
+    void (*fn)(void *);
+    void *arg;
+    void (*dealloc)(void *);
+};
+
+struct worker_stats {
+    size_t depth;           // tasks queued on the worker now
+    uint64_t executed;
+    uint64_t stolen;        // tasks it took from other workers
+    uint64_t busy_us;       // time spent running tasks
+};
+
+// work-stealing task pool. each worker has its own deque; tasks submitted
+// from a worker go to that worker's deque, others are spread round robin,
+// and a worker that runs dry takes tasks from the others before sleeping.
+// there is no shared queue for the workers to contend on.
+class scheduler {
+
+protected:
+    struct alignas(64) worker {
+        std::mutex mutex;
+        std::deque<task> tasks;
+        std::atomic<uint64_t> executed;
+        std::atomic<uint64_t> stolen;
+        std::atomic<uint64_t> busy_us;
+        std::thread thread;
+
+        worker(): executed(0), stolen(0), busy_us(0) {}
+    };
+
+    std::vector<std::unique_ptr<worker>> _workers;
+    std::atomic<size_t> _pending;
+    std::atomic<size_t> _next;
+
+    // idle workers sleep here until a task is submitted
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::atomic<int> _sleeping;
+    bool _done = false;
+
+    void run(size_t index);
+    bool pop(size_t index, task &t);
+    bool steal(size_t index, task &t);
+
+public:
+    scheduler(): _pending(0), _next(0), _sleeping(0) {}
+    ~scheduler();
+
+    void start(int threads);
+    bool started() { return !_workers.empty(); }
+    size_t size() { return _workers.size(); }
+
+    // run fn(arg) on a worker, then dealloc(arg) if given
+    void submit(void (*fn)(void *), void *arg, void (*dealloc)(void *));
+
+    // one entry per worker
+    void stats(std::vector<worker_stats> &out);
+};
+
+extern scheduler tasks;
+
+}
+
+#endif  // __SCHEDULER_H
@@ -31,22 +31,40 @@
 
 //////////////////////////////////// client //////////////////////////////////
 
-cm_thread::pool *thread_pool_ptr = nullptr;
+// runs strands when the scheduler is not started
+cm_thread::pool *worker_pool_ptr = nullptr;
 
 cm_net::client_thread *client = nullptr;
 bool connected = false;
 int host_port = -1;
-int echo_fd = -1;
 
-// instance name for fingerprint (e.g., vortex_369)
+// last replication batch applied from the upstream server, and the
+// upstream epoch its sequence number belongs to
+std::atomic<uint64_t> upstream_seq(0);
+std::atomic<uint64_t> upstream_epoch(0);
+
+// instance name (e.g., vortex_369)
 std::string instance_name;
 
-// instance fingerprint (e.g., %%vortex_369)
-std::string instance_fingerprint;
+// instance id carried in the origin of replicated mutations
+uint32_t instance = 0;
+
+// origin of the replicated mutation this thread is applying
+thread_local const vortex::origin *applying_origin = nullptr;
+
+// the mutation this thread is applying came from our upstream
+thread_local bool applying_upstream = false;
+
+// this thread is running a binary protocol request
+thread_local bool binary_dispatch = false;
+
+// expiry of the write this thread is applying; 0 without a ttl
+thread_local uint64_t request_expires = 0;
 
 void server_echo(int fd, const char *buf, size_t sz);
 void request_handler(void *arg);
 void request_dealloc(void *arg);
+void submit_event(cm_net::input_event *event);
 
 void _sleep(int interval /* ms */) {
 
@@ -67,7 +85,13 @@ void client_receive(int socket, const char *buf, size_t sz) {
     std::string request(buf, sz);
 
     if(request == "$:VORTEX\n") {
-        server_echo(socket, "$:VORTEX_CLIENT\n", 16);
+        // after a reconnect, ask to resume after the last batch applied
+        std::string reply("$:VORTEX_CLIENT\n");
+        if(upstream_seq > 0) {
+            reply = cm_util::format("$:VORTEX_CLIENT %llu %llu\n", (unsigned long long) upstream_seq.load(),
+                (unsigned long long) upstream_epoch.load());
+        }
+        server_echo(socket, reply.c_str(), reply.size());
         return;
     }
 
@@ -80,9 +104,9 @@ void client_receive(int socket, const char *buf, size_t sz) {
          request);
 
     if(nullptr != event) {
-        // add data to thread pool which will call this vortex
-        // server's request handler to update our cache
-        thread_pool_ptr->add_task(request_handler, event, request_dealloc);
+        // queue on this socket's strand; a pool worker will call this
+        // vortex server's request handler to update our cache
+        submit_event(event);
     }
     else {
          cm_log::critical("client_receive: pool_server: error: event allocation failed!");
@@ -132,187 +156,328 @@ struct watcher {
 };
 
 
-bool loop_analysis(std::vector<std::pair<std::string, std::string>> &input) {
+// sockets that upgraded to the binary protocol, and sockets that have not
+// answered the hello yet
+class protocol_store: protected cm::mutex {
 
-    // flatten key/value pairs into route strings
-    // examples:
-    // 12/03/2019 18:21:42 [info]: etok xray pub etok
-    // 12/03/2019 18:21:42 [info]: etok red
-    // 12/03/2019 18:21:42 [info]: etok pub etok
-    // 12/03/2019 18:21:42 [info]: xray pub etok
-    // 12/03/2019 18:21:42 [info]: pub etok xray pub etok    
+protected:
+    std::unordered_set<int> _binary;
+    std::unordered_set<int> _fresh;
+    std::atomic<size_t> _count;         // skip the lock while nobody upgraded
+    std::atomic<size_t> _fresh_count;   // or while no hello is unanswered
 
-    std::vector<std::string> route[input.size()];
-    int index = 0;
+public:
+    protocol_store(): _count(0), _fresh_count(0) {}
 
-    // for each input 
-    for(auto it = input.begin(); it != input.end(); ++it) {
+    bool binary(int fd) {
+        if(_count == 0) return false;
+        lock();
+        bool b = _binary.count(fd) > 0;
+        unlock();
+        return b;
+    }
 
-        std::string in_key = it->first;
-        std::string in_pub = it->second;
+    void set_binary(int fd) {
+        lock();
+        _binary.insert(fd);
+        _count = _binary.size();
+        unlock();
+    }
 
-        route[index].push_back(in_key);
-        route[index].push_back(in_pub);
+    // a new socket was sent the hello
+    void set_fresh(int fd) {
+        lock();
+        _fresh.insert(fd);
+        _fresh_count = _fresh.size();
+        unlock();
+    }
 
-        // look for key that matches in_pub
-        for(auto pt = input.begin(); pt != input.end(); ++pt) {
-            std::string key = pt->first;
-            std::string pub = pt->second;
-            if(key == in_pub) {
-                route[index].push_back(pub);
-                // new search term forward
-                in_pub = pub;
-            }
-         }
-         index++;
+    // true only for the first line a socket sends after the hello
+    bool take_fresh(int fd) {
+        if(_fresh_count == 0) return false;
+        lock();
+        bool b = _fresh.erase(fd) > 0;
+        _fresh_count = _fresh.size();
+        unlock();
+        return b;
     }
 
-    // count the number of times each key occurs in the route
-    // more than once means it is a loop in the route
+    void remove(int fd) {
+        if(_count == 0 && _fresh_count == 0) return;
+        lock();
+        _binary.erase(fd);
+        _fresh.erase(fd);
+        _count = _binary.size();
+        _fresh_count = _fresh.size();
+        unlock();
+    }
+};
+
+protocol_store protocols;
+
+class watcher_store: protected cm::mutex {
+
+protected:
+    // unordered map for faster access vs. map using buckets
+    std::unordered_map<std::string,std::vector<watcher>> _map;
 
-    bool found_loop = false;
+    // prefix watches (*orders.* #tag), by prefix; a write finds every
+    // prefix of its key in one walk of the tree
+    vortex::radix_tree<std::vector<watcher>> _prefixes;
+    std::atomic<size_t> _prefix_count;
 
-    for(int k = 0; k < input.size(); k++) {
-        std::string s;
-        std::map<std::string,int> counts;
+    // reverse index: names (keys or patterns) each socket watches, so a
+    // disconnect only visits its own watches
+    std::unordered_map<int,std::unordered_set<std::string>> _fds;
 
-        // build output log string and key count
-        for(auto it = route[k].begin(); it != route[k].end(); ++it) {
-            s += (*it) + " ";
-            counts[*it]++;
+    // publish graph: watched name -> publish targets, with the number of
+    // watchers making each edge. kept up to date as watches come and go,
+    // and acyclic: an edge that would close a loop is refused.
+    std::unordered_map<std::string,std::unordered_map<std::string,size_t>> _graph;
+
+    // prefix patterns with publish edges
+    std::set<std::string> _pub_patterns;
+
+    void link(const std::string &name, const watcher &w) {
+        if(w.pub.size() < 2) return;
+        _graph[name][w.pub.substr(1)]++;
+        std::string prefix;
+        if(is_pattern(name, prefix)) _pub_patterns.insert(name);
+    }
+
+    void unlink(const std::string &name, const watcher &w) {
+        if(w.pub.size() < 2) return;
+        auto g = _graph.find(name);
+        if(g == _graph.end()) return;
+        auto e = g->second.find(w.pub.substr(1));
+        if(e != g->second.end() && --e->second == 0) g->second.erase(e);
+        if(g->second.empty()) {
+            _graph.erase(g);
+            _pub_patterns.erase(name);
         }
+    }
 
-        // sum the number of keys that occur more than once;
-        // that is the total number of loops in the route
-        int loop_sum = 0;
-        for(auto &it : counts) {
-            int count = it.second;
-            if(count > 1) {
-                loop_sum += (count - 1);
-                found_loop = true;
+    // call f(target) for each edge out of key: its own and those of the
+    // prefix patterns that match it
+    template<class F>
+    void edges(const std::string &key, F f) {
+        auto g = _graph.find(key);
+        if(g != _graph.end()) {
+            for(auto &e : g->second) f(e.first);
+        }
+        for(auto &pattern : _pub_patterns) {
+            if(pattern == key) continue;
+            if(key.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0) {
+                for(auto &e : _graph[pattern]) f(e.first);
             }
         }
+    }
 
-        std::string loop_report = loop_sum > 0 ?
-         cm_util::format("%d loop(s)", loop_sum) : "OK";
+    // would an edge name -> target close a loop? only the part of the
+    // graph reachable from target is visited
+    bool creates_loop(const std::string &name, const std::string &target) {
+        std::string prefix;
+        bool pattern = is_pattern(name, prefix);
+
+        std::vector<std::string> stack(1, target);
+        std::unordered_set<std::string> seen;
+        while(!stack.empty()) {
+            std::string key = std::move(stack.back());
+            stack.pop_back();
+            if(key == name || (pattern && key.compare(0, prefix.size(), prefix) == 0)) {
+                return true;
+            }
+            if(!seen.insert(key).second) continue;
+            edges(key, [&stack](const std::string &t) { stack.push_back(t); });
+        }
+        return false;
+    }
 
-        std::string msg = cm_util::format("%s: %s", s.c_str(), 
-            loop_report.c_str());
+    // counting filter over the watched keys, read without the lock. each
+    // key maps to two slots; a zero in either means nobody watches it, so
+    // writes to unwatched keys never touch the mutex. the mutex is only
+    // taken when watches change or a key may be watched.
+    static const size_t filter_size = 1 << 20;
+    std::unique_ptr<std::atomic<uint32_t>[]> _filter;
+
+    void filter_slots(const std::string &name, size_t &a, size_t &b) {
+        uint64_t h = std::hash<std::string>()(name) * 0x9E3779B97F4A7C15ULL;
+        a = (size_t) (h >> 44);
+        b = (size_t) (h >> 20) & (filter_size - 1);
+    }
 
-        if(loop_sum > 0) cm_log::error(msg.c_str());
-        else cm_log::info(msg.c_str());
+    void filter_add(const std::string &name, int delta) {
+        size_t a, b;
+        filter_slots(name, a, b);
+        _filter[a].fetch_add(delta, std::memory_order_release);
+        _filter[b].fetch_add(delta, std::memory_order_release);
     }
 
-    return found_loop == false;
-}
+    bool maybe_watched(const std::string &name) {
+        size_t a, b;
+        filter_slots(name, a, b);
+        return _filter[a].load(std::memory_order_acquire) != 0 &&
+            _filter[b].load(std::memory_order_acquire) != 0;
+    }
 
-// when notify has a watcher with a pub key, it will put the publish
-// request in this queue
-cm_queue::double_queue<std::string> pub_queue;
+    // watchers of a key or pattern, or nullptr
+    std::vector<watcher> *find(const std::string &name) {
+        std::string prefix;
+        if(is_pattern(name, prefix)) {
+            return _prefixes.find(prefix);
+        }
+        auto i = _map.find(name);
+        return i != _map.end() ? &i->second : nullptr;
+    }
 
-class watcher_store: protected cm::mutex {
+    std::vector<watcher> &insert(const std::string &name) {
+        std::string prefix;
+        if(is_pattern(name, prefix)) {
+            if(nullptr == _prefixes.find(prefix)) _prefix_count++;
+            return _prefixes.insert(prefix);
+        }
+        auto i = _map.find(name);
+        if(i == _map.end()) {
+            filter_add(name, 1);
+            i = _map.emplace(name, std::vector<watcher>()).first;
+        }
+        return i->second;
+    }
 
-protected:
-    // unordered map for faster access vs. map using buckets
-    std::unordered_map<std::string,std::vector<watcher>> _map;
+    void erase(const std::string &name) {
+        std::string prefix;
+        if(is_pattern(name, prefix)) {
+            if(_prefixes.erase(prefix)) _prefix_count--;
+        }
+        else if(_map.erase(name) > 0) {
+            filter_add(name, -1);
+        }
+    }
 
-public:
+    // drop fd's watchers of one name; the name goes when no watchers remain
+    size_t remove_watchers(const std::string &name, int fd) {
+        std::vector<watcher> *v = find(name);
+        if(nullptr == v) return 0;
 
+        size_t num_erased = 0;
+        for(auto it = v->begin(); it != v->end();) {
+            if(it->fd == fd) {
+                unlink(name, *it);
+                it = v->erase(it);
+                num_erased++;
+            }
+            else {
+                it++;
+            }
+        }
 
-    void get_publishers(std::vector<std::pair<std::string, std::string>> &outv) {
+        // remove if no other sockets watching this key
+        if(v->size() == 0) {
+            erase(name);
+            CM_LOG_TRACE { cm_log::info(cm_util::format("removed key: [%s] (no more watchers)", name.c_str())); }
+        }
+        return num_erased;
+    }
 
-        for(auto it = _map.begin(); it != _map.end(); ++it) {
-            std::string name = it->first;
-            std::vector<watcher> &v = it->second;
+public:
 
-            for(auto wit = v.begin(); wit != v.end(); ++wit) {
-                if(wit->pub.size() > 0) {
-                    auto p = std::make_pair(name, wit->pub.substr(1));
-                    outv.push_back(p);
-                }
-            }
-        }
+    watcher_store(): _prefix_count(0), _filter(new std::atomic<uint32_t>[filter_size]()) {}
+
+    // a name ending in '*' watches every key that starts with the rest
+    static bool is_pattern(const std::string &name, std::string &prefix) {
+        if(name.empty() || name.back() != '*') return false;
+        prefix.assign(name, 0, name.size() - 1);
+        return true;
     }
-    
+
     bool check(const std::string &name) {
         lock();
-        bool b = _map.find(name) != _map.end();
+        bool b = nullptr != find(name);
         unlock();
         return b;
     }
 
     bool check(const std::string &name, const watcher &w) {
         lock();
-        std::vector<watcher> &v = _map[name];
- 
-        // scan for matching watcher
         bool found = false;
-        for(auto it = v.begin(); it != v.end(); it++) {
-            if(it->fd == w.fd && it->tag == w.tag && it->remove == w.remove) {
-                found = true;
-                break;
+        std::vector<watcher> *v = find(name);
+        if(nullptr != v) {
+            // scan for matching watcher
+            for(auto it = v->begin(); it != v->end(); it++) {
+                if(it->fd == w.fd && it->tag == w.tag && it->remove == w.remove) {
+                    found = true;
+                    break;
+                }
             }
-        }       
+        }
         unlock();
         return found;
     }
 
+    // add a watcher; false if its publish target would close a loop, in
+    // which case it is added without one
     bool add(const std::string &name, const watcher &w) {
         lock();
-        std::vector<watcher> &v = _map[name];
-        v.push_back(w);
+        bool ok = true;
+        watcher _w(w);
+        if(_w.pub.size() > 1 && creates_loop(name, _w.pub.substr(1))) {
+            _w.pub.clear();
+            ok = false;
+        }
+        insert(name).push_back(_w);
+        link(name, _w);
+        _fds[w.fd].insert(name);
         unlock();
-        return true;
+        return ok;
     }
 
     size_t remove(const std::string &name) {
         lock();
-        size_t num_erased = _map.erase(name);
+        size_t num_erased = 0;
+        std::vector<watcher> *v = find(name);
+        if(nullptr != v) {
+            for(auto &w : *v) {
+                unlink(name, w);
+                auto f = _fds.find(w.fd);
+                if(f == _fds.end()) continue;
+                f->second.erase(name);
+                if(f->second.empty()) _fds.erase(f);
+            }
+            erase(name);
+            num_erased = 1;
+        }
         unlock();
         return num_erased;   
     }
     
+    // O(watches held by fd), not O(all watched keys)
     size_t remove(int fd) {
         size_t num_erased = 0;
         lock();
 
-        for(auto i = _map.begin(); i != _map.end();) {
-
-            std::vector<watcher> &v = i->second;
-
-            // remove matching fd
-            for(auto it = v.begin(); it != v.end();) {
-                if(it->fd == fd) {
-                    it = v.erase(it);
-                    num_erased++;
-                }
-                else {
-                    it++;
-                }
-            }
-
-            // remove if no other sockets watching this key 
-            if(v.size() == 0) {
-                std::string name = std::move(i->first);    
-                i = _map.erase(i);
-                CM_LOG_TRACE { cm_log::info(cm_util::format("removed key: [%s] (no more watchers)", name.c_str())); }
-            }
-            else {
-                i++;
+        auto f = _fds.find(fd);
+        if(f != _fds.end()) {
+            for(auto &name : f->second) {
+                num_erased += remove_watchers(name, fd);
             }
+            _fds.erase(f);
         }
-        
+
         unlock();
         return num_erased;   
     }
 
     bool notify(const std::string &name, const std::string &value, cm_cache::cache_event &event) {
-        lock();
+
+        // most keys are never watched
+        if(_prefix_count == 0 && !maybe_watched(name)) return false;
+
+        // (fd, tag, prefix watch) of each watcher; messages are queued
+        // after unlock
+        std::vector<std::tuple<int,std::string,bool>> targets;
         bool do_remove = false;
-        if(_map.find(name) != _map.end()) {
 
-            // notify watchers
-            std::vector<watcher> &v = _map[name];
+        auto collect = [&](std::vector<watcher> &v, bool prefix) {
             for(auto &_watcher: v) {
 
                 CM_LOG_TRACE {
@@ -320,120 +485,260 @@ public:
                     cm_log::hex_dump(cm_log::level::info, value.c_str(), value.size(), 16);
                 }
 
-                cm_net::send(_watcher.fd,
-                cm_util::format("%s:%s\n", _watcher.tag.c_str(), value.c_str()));
+                targets.emplace_back(_watcher.fd, _watcher.tag, prefix);
 
-                if(_watcher.pub.size() > 0) {
+                // an expired key has no value to publish
+                if(_watcher.pub.size() > 0 && value.size() > 0) {
                     // publish data to specified key
                     std::string request = _watcher.pub;   //+key
                     request.append(" ");
                     request.append(value); 
-                    // add request to pub queue
-                    pub_queue.push_back( request );
+                    // applied by the publish stage, off this request
+                    vortex::publisher.push(std::move(request), event.fd);
                 }
 
                 if(_watcher.remove) { 
                     do_remove = true;
                 }
             }
+        };
+
+        lock();
+        auto i = _map.find(name);
+        if(i != _map.end()) {
+            // notify watchers
+            collect(i->second, false);
+        }
+        if(_prefix_count > 0) {
+            _prefixes.match(name, [&](std::vector<watcher> &v) { collect(v, true); });
         }
         unlock();
+
+        // onto each subscriber's bounded queue; the flusher thread writes
+        // them out, so a slow subscriber never holds up this caller.
+        // prefix watchers are told which key changed: tag:key:value
+        for(auto &t : targets) {
+            const std::string &tag = std::get<1>(t);
+            bool prefix = std::get<2>(t);
+
+            std::string key(name);
+            key.append(prefix ? "*#" : "#");
+            key.append(tag);
+
+            std::string msg;
+            if(protocols.binary(std::get<0>(t))) {
+                vortex::encode_wire_frame(msg, '#', vortex::wire_ok, 0, tag, name, value);
+            }
+            else if(prefix) {
+                msg = cm_util::format("%s:%s:%s\n", tag.c_str(), name.c_str(), value.c_str());
+            }
+            else {
+                msg = cm_util::format("%s:%s\n", tag.c_str(), value.c_str());
+            }
+            vortex::notify(std::get<0>(t), key, std::move(msg));
+        }
         return do_remove;
     }
 
+    // every publish route, one per line: a +b +c; at most max_routes
+    void routes(std::vector<std::string> &out, size_t max_routes = 10000) {
+        lock();
+
+        // start from names nothing publishes to
+        std::unordered_set<std::string> targets;
+        for(auto &g : _graph) {
+            for(auto &e : g.second) targets.insert(e.first);
+        }
+
+        std::vector<std::string> path;
+        std::function<void(const std::string &)> walk = [&](const std::string &key) {
+            if(out.size() >= max_routes) return;
+            path.push_back(key);
+            bool leaf = true;
+            edges(key, [&](const std::string &t) {
+                leaf = false;
+                walk(t);
+            });
+            if(leaf) {
+                std::string route = path[0];
+                for(size_t n = 1; n < path.size(); n++) route.append(" +").append(path[n]);
+                out.push_back(route);
+            }
+            path.pop_back();
+        };
+
+        for(auto &g : _graph) {
+            if(targets.find(g.first) == targets.end()) walk(g.first);
+        }
+        unlock();
+    }
+
     size_t size() {
         lock();
-        size_t size = _map.size();
+        size_t size = _map.size() + _prefixes.size();
         unlock();
         return size;
     }
 
     void clear() {
         lock();
+        for(auto &it : _map) filter_add(it.first, -1);
         _map.clear();
+        _prefixes.clear();
+        _prefix_count = 0;
+        _fds.clear();
+        _graph.clear();
+        _pub_patterns.clear();
         unlock();
     }
 };
 
-bool filter_fingerprints(const std::string &request, cm_cache::cache_event &event) {
+// partial request lines carried over between reads, by socket
+class input_store: protected cm::mutex {
 
-    // look for our instance fingerprint in request
-    size_t index = request.find(instance_fingerprint);
-    if(index != std::string::npos) {
-        CM_LOG_TRACE {
-            cm_log::info(cm_util::format("%d: ignoring looped request", event.fd));
-        }
-        // ignore this request
-        return false;
-    }    
+protected:
+    std::unordered_map<int,std::string> _map;
 
-    // look for start of fingerprint(s)
-    index = request.find("%%vortex%%");
-    if(index != std::string::npos) {
-        size_t end_index = request.find("\n");
-        if(end_index == std::string::npos) {
-            end_index = request.size() - 1;
-        }
+public:
 
-        size_t start_index = index + 8;
-        event.fingerprints.assign(request.substr(start_index, end_index - start_index));
-        CM_LOG_TRACE {
-            cm_log::info(cm_util::format("%d: remote fingerprint(s):", event.fd));
-            cm_log::hex_dump(cm_log::level::info, event.fingerprints.c_str(),
-                 event.fingerprints.size(), 16);
+    // prepend any partial line carried over from the last read on fd
+    void take(int fd, std::string &input) {
+        lock();
+        auto it = _map.find(fd);
+        if(it == _map.end()) {
+            unlock();
+            return;
         }
-        
-        // request stripped of fingerprints
-        event.request.assign(request.substr(0, index));
-        event.request.append("\n");
+        std::string buf = std::move(it->second);
+        _map.erase(it);
+        unlock();
+
+        buf.append(input);
+        input.swap(buf);
     }
-    else {
-        // no fingerprints
-        // assign event.request
-        event.request.assign(request);
+
+    // keep a partial line until the rest of it arrives
+    void put(int fd, const char *buf, size_t sz) {
+        lock();
+        _map[fd].assign(buf, sz);
+        unlock();
     }
 
-    return true;
-}
+    size_t remove(int fd) {
+        lock();
+        size_t num_erased = _map.erase(fd);
+        unlock();
+        return num_erased;
+    }
+};
 
-void fingerprint(std::string &request, cm_cache::cache_event &event) {
-    // add fingerprints to request
+input_store inputs;
 
-    std::string s("%%vortex");
-    s.append(event.fingerprints);
-    s.append(instance_fingerprint);
-    s.append("\n");
+// keys the upstream last wrote when it began a full copy of its store.
+// each key the copy sends is struck off; those left when it ends are gone
+// upstream and are removed. keys written here are never swept: with two
+// servers replicating to each other, they are writes the upstream missed
+// while it was down, not deletes it made
+class resync_sweep: protected cm::mutex {
+
+protected:
+    std::unordered_set<std::string> _stale;
+    bool _active = false;
 
-    size_t index = request.find("\n");
-    if(index != std::string::npos) {
-        request.replace(request.begin()+index, request.begin()+index+1,
-            s.begin(), s.end());
+public:
+
+    void begin() {
+        std::unordered_set<std::string> keys;
+        vortex::shard_store *store = vortex::mem_store;
+        for(size_t i = 0; i < store->shards(); i++) {
+            store->visit(i, [&keys](const std::string &key, const vortex::entry &e) {
+                if(e.upstream) keys.insert(key);
+            });
+        }
+        lock();
+        _stale.swap(keys);
+        _active = true;
+        unlock();
     }
-    else {    
-        request.append(s);
+
+    void seen(const std::string &name) {
+        lock();
+        if(_active) _stale.erase(name);
+        unlock();
     }
-}
 
+    // remove what the copy did not send; journaled, so that it also
+    // reaches our own peers
+    size_t end() {
+        std::unordered_set<std::string> stale;
+        lock();
+        if(!_active) {
+            unlock();
+            return 0;
+        }
+        _active = false;
+        stale.swap(_stale);
+        unlock();
 
+        size_t removed = 0;
+        for(auto &name : stale) {
+            // remove first: a key written here meanwhile is kept, and
+            // nothing is journaled for it
+            vortex::mutation_guard guard;
+            if(vortex::mem_store->remove_upstream(name) == 0) continue;
+            journal.append('-', name, "", "-" + name + "\n");
+            removed++;
+        }
+        return removed;
+    }
+};
+
+resync_sweep sweep;
+
+// longest partial line or frame kept waiting for the rest of it; a client
+// that goes past it is disconnected
+const size_t max_request_size = 64 * 1024 * 1024;
 
 watcher_store watchers;
 
 class vortex_processor: public cm_cache::scanner_processor {
 
+protected:
+    // a mutation the journal could not make durable (a failed sync under
+    // -f batch) is not applied, and answered with an error
+    bool journal_failed(const std::string &name, cm_cache::cache_event &event) {
+        event.value.clear();
+        event.result.assign(cm_util::format("error: journal write failed: %s", name.c_str()));
+        cm_log::error(event.result);
+        do_result(event);
+        return false;
+    }
+
 public:
     bool do_add(const std::string &name, const std::string &value, cm_cache::cache_event &event) {
 
         //cm_log::info(cm_util::format("+%s %s", name.c_str(), value.c_str()));
 
-        // journal first to guard rotation
-        journal.info(event.request);
+        {
+            // journal first to guard rotation; the mutation guard lets a
+            // snapshot wait until the journaled change is in the store
+            vortex::mutation_guard guard;
+            if(!journal.append('+', name, value, event.request, applying_origin, request_expires)) {
+                return journal_failed(name, event);
+            }
+
+            // stamp after journaling: a rotation in between only makes the
+            // key outlive its journal by one segment, never the reverse
+            vortex::mem_store->set(name, value, vortex::current_segment(), request_expires,
+                applying_upstream);
+        }
 
-        if(echo_fd != -1) {
-            fingerprint(event.request, event);
-            server_echo(echo_fd, event.request.c_str(), event.request.size());
+        if(request_expires > 0) {
+            vortex::expiry.schedule(name, request_expires);
         }
 
-        cm_store::mem_store.set(name, value);
+        // a write that takes the store over its memory budget wakes the evictor
+        vortex::eviction.check();
 
         event.name.assign(name);
         event.value.assign(value);
@@ -446,9 +751,7 @@ public:
     
         //cm_log::info(cm_util::format("$%s", name.c_str()));
 
-        journal.lock();  // guard rotation
-        event.value = cm_store::mem_store.find(name);
-        journal.unlock();
+        event.value = vortex::mem_store->find(name);
 
         event.name.assign(name);
         if(event.value.size() > 0) {
@@ -464,20 +767,18 @@ public:
     
         //cm_log::info(cm_util::format("!%s", name.c_str()));
 
-        journal.lock();  // guard rotation
-        event.value = cm_store::mem_store.find(name);
-        journal.unlock();
+        event.value = vortex::mem_store->find(name);
 
         event.name.assign(name);
         if(event.value.size() > 0) {
             event.result.assign(cm_util::format("%s:%s", name.c_str(), event.value.c_str()));
 
-            journal.info(event.request);
-            int num = cm_store::mem_store.remove(name);
-
-            if(echo_fd != -1) {
-                fingerprint(event.request, event);
-                server_echo(echo_fd, event.request.c_str(), event.request.size());
+            {
+                vortex::mutation_guard guard;
+                if(!journal.append('!', name, "", event.request, applying_origin)) {
+                    return journal_failed(name, event);
+                }
+                vortex::mem_store->remove(name);
             }
 
         }
@@ -491,15 +792,16 @@ public:
     
         cm_log::info(cm_util::format("-%s", name.c_str()));
 
-        // journal first to guard rotation
-        journal.info(event.request);
-
-        if(echo_fd != -1) {
-            fingerprint(event.request, event);
-            server_echo(echo_fd, event.request.c_str(), event.request.size());
+        int num;
+        {
+            // journal first to guard rotation
+            vortex::mutation_guard guard;
+            if(!journal.append('-', name, "", event.request, applying_origin)) {
+                return journal_failed(name, event);
+            }
+            num = vortex::mem_store->remove(name);
         }
 
-        int num = cm_store::mem_store.remove(name);
         event.result.assign(cm_util::format("(%d):%s", num, name.c_str()));
         return do_result(event);
     }
@@ -508,34 +810,21 @@ public:
 
         cm_log::info(cm_util::format("*%s #%s %s", name.c_str(), tag.c_str(), event.pub_name.c_str()));
 
-        journal.lock();     // guard rotation
-        event.value = cm_store::mem_store.find(name);
-        journal.unlock();
+        // a prefix watch has no current value of its own
+        std::string prefix;
+        if(!watcher_store::is_pattern(name, prefix)) {
+            event.value = vortex::mem_store->find(name);
+        }
 
         event.name = name;
         event.tag = tag;
 
-        // if pub name, do loop_analysis before allowing in new watcher
-        std::string pub_name = event.pub_name;
-        if(pub_name.size() > 0) {
-            std::vector<std::pair<std::string, std::string>> input;
-
-            // get current publishers
-            watchers.get_publishers(input);
-
-            // add candidate pair
-            auto p = std::make_pair(name, pub_name.substr(1));
-            input.push_back(p);
-
-            if(loop_analysis(input) == false) {
-                pub_name = "";
-                cm_log::warning(cm_util::format("[%s] did not pass loop analysis, ignoring", event.pub_name.c_str()));
-            }
-        }
-
-        watcher w(event.fd, event.tag, pub_name, false /*remove*/);
+        watcher w(event.fd, event.tag, event.pub_name, false /*remove*/);
         if(watchers.check(name, w) == false) {
-            watchers.add(name, w);
+            // a publish target that would close a loop is dropped
+            if(watchers.add(name, w) == false) {
+                cm_log::warning(cm_util::format("[%s] would create a publish loop, ignoring", event.pub_name.c_str()));
+            }
         }
         else {
             CM_LOG_TRACE { cm_log::trace(cm_util::format("watch already active: *%s #%s",
@@ -550,34 +839,21 @@ public:
 
         cm_log::info(cm_util::format("@%s #%s %s", name.c_str(), tag.c_str(), event.pub_name.c_str()));
 
-        journal.lock();     // guard rotationn
-        event.value = cm_store::mem_store.find(name);
-        journal.unlock();
+        // a prefix watch has no current value of its own
+        std::string prefix;
+        if(!watcher_store::is_pattern(name, prefix)) {
+            event.value = vortex::mem_store->find(name);
+        }
 
         event.name = name;
         event.tag = tag;
 
-        // if pub name, do loop_analysis before allowing in new watcher
-        std::string pub_name = event.pub_name;
-        if(pub_name.size() > 0) {
-            std::vector<std::pair<std::string, std::string>> input;
-
-            // get current publishers
-            watchers.get_publishers(input);
-
-            // add candidate pair
-            auto p = std::make_pair(name, pub_name.substr(1));
-            input.push_back(p);
-
-            if(loop_analysis(input) == false) {
-                pub_name = "";
-                cm_log::warning(cm_util::format("[%s] did not pass loop analysis, ignoring", event.pub_name.c_str()));
-            }
-        }
-
-        watcher w(event.fd, event.tag, pub_name, true /*remove*/);
+        watcher w(event.fd, event.tag, event.pub_name, true /*remove*/);
         if(watchers.check(name, w) == false) {
-            watchers.add(name, w);
+            // a publish target that would close a loop is dropped
+            if(watchers.add(name, w) == false) {
+                cm_log::warning(cm_util::format("[%s] would create a publish loop, ignoring", event.pub_name.c_str()));
+            }
         }
         else {
             CM_LOG_TRACE { cm_log::trace(cm_util::format("watch already active: @%s #%s",
@@ -590,10 +866,14 @@ public:
 
     bool do_result(cm_cache::cache_event &event) {
 
-        bool send = (connected && client->get_socket() == event.fd) ? false : true;
+        // a binary request is answered with a frame by its dispatcher, and
+        // a publish (fd -1) by nobody
+        bool send = event.fd < 0 || (connected && client->get_socket() == event.fd) ||
+            binary_dispatch ? false : true;
 
         if(send) {
-            cm_net::send(event.fd, event.result.append("\n"));
+            // collected into the batch for this input; one write per batch
+            vortex::send(event.fd, event.result.append("\n"));
 
             CM_LOG_TRACE {
                 cm_log::trace(cm_util::format("%d: sent response:", event.fd));
@@ -611,7 +891,7 @@ public:
 
             // notify watchers
             if(watchers.notify(event.name, event.value, event)) {
-                cm_store::mem_store.remove(event.name);
+                vortex::mem_store->remove(event.name);
                 CM_LOG_TRACE { cm_log::trace(cm_util::format("removed on notify: %s", event.name.c_str())); }
             }
         }
@@ -632,9 +912,459 @@ public:
 
 vortex_processor processor;
 
+// move an event the pool will free when its task returns into one we own
+cm_net::input_event *take_event(cm_net::input_event *event) {
+    cm_net::input_event *e = new cm_net::input_event(event->fd, std::string());
+    e->msg.swap(event->msg);
+    e->eof = event->eof;
+    e->connect = event->connect;
+    return e;
+}
+
+// run a task on the work-stealing scheduler if it was started, otherwise
+// on the thread pool
+void submit_task(void (*fn)(void *), void *arg, void (*dealloc)(void *)) {
+    if(vortex::tasks.started()) {
+        vortex::tasks.submit(fn, arg, dealloc);
+    }
+    else {
+        worker_pool_ptr->add_task(fn, arg, dealloc);
+    }
+}
+
+// per-socket mailbox. events for one socket run one at a time in arrival
+// order, while different sockets run in parallel on the pool: the first
+// worker to get an event for an idle socket runs it, and then anything
+// that queued up for that socket in the meantime.
+class strand_store: protected cm::mutex {
+
+protected:
+    // a socket is present while one of its events is running
+    std::unordered_map<int,std::deque<cm_net::input_event *>> _map;
+
+public:
+
+    // true if the caller should run event now; otherwise a copy of it
+    // was queued behind the running one
+    bool enter(cm_net::input_event *event) {
+        lock();
+        auto it = _map.find(event->fd);
+        if(it == _map.end()) {
+            _map[event->fd];
+            unlock();
+            return true;
+        }
+
+        it->second.push_back(take_event(event));
+        unlock();
+        return false;
+    }
+
+    // next queued event for fd; nullptr releases the socket
+    cm_net::input_event *next(int fd) {
+        lock();
+        cm_net::input_event *e = nullptr;
+        auto it = _map.find(fd);
+        if(it != _map.end()) {
+            if(it->second.empty()) {
+                _map.erase(it);
+            }
+            else {
+                e = it->second.front();
+                it->second.pop_front();
+            }
+        }
+        unlock();
+        return e;
+    }
+
+    // true if fd has queued events, which it keeps; false releases it
+    bool pending(int fd) {
+        lock();
+        bool more = false;
+        auto it = _map.find(fd);
+        if(it != _map.end()) {
+            more = !it->second.empty();
+            if(!more) _map.erase(it);
+        }
+        unlock();
+        return more;
+    }
+};
+
+strand_store strands;
+
+// events one worker runs for a socket before handing it back to the pool
+const int max_strand_run = 64;
+
+void handle_event(cm_net::input_event *event);
+void strand_resume(void *arg);
+
+// run what queued up for fd behind the event just handled
+void run_strand(int fd) {
+    for(int n = 0;; n++) {
+        if(n == max_strand_run) {
+            // let other sockets have this worker; continue as a new task
+            if(strands.pending(fd)) {
+                submit_task(strand_resume,
+                    new cm_net::input_event(fd, std::string()), request_dealloc);
+            }
+            return;
+        }
+
+        cm_net::input_event *event = strands.next(fd);
+        if(nullptr == event) return;
+        handle_event(event);
+        delete event;
+    }
+}
+
+void strand_resume(void *arg) {
+    run_strand(((cm_net::input_event *) arg)->fd);
+}
+
+// handle an event that entered its socket's strand, then what queued
+// up behind it
+void strand_start(void *arg) {
+    cm_net::input_event *event = (cm_net::input_event *) arg;
+    handle_event(event);
+    run_strand(event->fd);
+}
+
+// reactor handler: the reactor's thread reads its sockets, so it enters
+// each event in its strand in arrival order and runs the strand itself
 void request_handler(void *arg) {
 
     cm_net::input_event *event = (cm_net::input_event *) arg;
+    if(strands.enter(event)) {
+        strand_start(event);
+    }
+}
+
+// queue an event we own on its socket's strand, in the caller's order
+void submit_event(cm_net::input_event *event) {
+    if(strands.enter(event)) {
+        submit_task(strand_start, event, request_dealloc);
+    }
+    else {
+        // its contents were moved into the strand
+        delete event;
+    }
+}
+
+// pool_server handler: the listener's pool has one thread, which only
+// puts each event in its strand, in arrival order, and hands a newly
+// started strand to the scheduler or the worker pool. entering the strand
+// on a pool of several threads could reorder two reads of one socket
+void request_submit(void *arg) {
+
+    cm_net::input_event *event = (cm_net::input_event *) arg;
+    if(strands.enter(event)) {
+        submit_task(strand_start, take_event(event), request_dealloc);
+    }
+}
+
+// our connection to the upstream server, or a peer we replicate to
+bool replication_socket(int socket) {
+    return (nullptr != client && client->get_socket() == socket) || vortex::replication.is_peer(socket);
+}
+
+// apply a mutation replicated by a peer straight to the processor; it
+// is not parsed as a request
+void apply_frame(int socket, const vortex::origin &from, const vortex::record_view &rec,
+    cm_cache::cache_event &event) {
+
+    // our own mutation, come back around a loop of peers
+    if(from.contains(instance)) {
+        CM_LOG_TRACE { cm_log::trace(cm_util::format("%d: ignoring looped mutation", socket)); }
+        return;
+    }
+
+    event.clear();
+    event.fd = socket;
+    std::string name(rec.key, rec.key_len);
+
+    sweep.seen(name);
+
+    applying_origin = &from;
+    applying_upstream = nullptr != client && client->get_socket() == socket;
+    if(rec.op == '+') {
+        std::string value(rec.value, rec.value_len);
+        // the peer's expiry stands, so a key expires alike on every peer
+        request_expires = rec.expires;
+        processor.do_add(name, value, event);
+        request_expires = 0;
+    }
+    else {
+        processor.do_remove(name, event);
+    }
+    applying_origin = nullptr;
+    applying_upstream = false;
+}
+
+// run a binary protocol request on the processor and answer it with a
+// frame; keys and values are taken as they are, without parsing. only a
+// binary journal accepts the upgrade, so no text form is built
+void dispatch_frame(int socket, const vortex::wire_frame &f, cm_cache::cache_event &event) {
+
+    event.clear();
+    event.fd = socket;
+    std::string name(f.key);
+    uint8_t status = vortex::wire_ok;
+
+    binary_dispatch = true;
+    switch(f.op) {
+    case '+': {
+        std::string value(f.value);
+        // a set's tag, if any, is its ttl in seconds
+        uint64_t ttl = strtoull(std::string(f.tag).c_str(), NULL, 10);
+        request_expires = ttl > 0 ? vortex::expiry_clock() + ttl * 1000 : 0;
+        if(!processor.do_add(name, value, event)) status = vortex::wire_error;
+        request_expires = 0;
+        break;
+    }
+    case '$':
+        processor.do_read(name, event);
+        break;
+    case '!':
+        if(!processor.do_read_remove(name, event)) status = vortex::wire_error;
+        break;
+    case '-':
+        if(!processor.do_remove(name, event)) {
+            status = vortex::wire_error;
+            break;
+        }
+        // answer with the number removed, from (num):name
+        event.value.assign(event.result, 1, event.result.find(')') - 1);
+        break;
+    case '*':
+    case '@': {
+        std::string tag(f.tag);
+        if(f.value.size() > 0) {
+            event.pub_name.assign("+");
+            event.pub_name.append(f.value);
+        }
+        if(f.op == '*') {
+            processor.do_watch(name, tag, event);
+        }
+        else {
+            processor.do_watch_remove(name, tag, event);
+        }
+        break;
+    }
+    default:
+        cm_log::error(cm_util::format("%d: unknown binary op 0x%02x", socket, f.op));
+        status = vortex::wire_error;
+        break;
+    }
+    binary_dispatch = false;
+
+    if((f.op == '$' || f.op == '!') && status == vortex::wire_ok && event.value.empty()) {
+        status = vortex::wire_not_found;
+    }
+
+    std::string frame;
+    vortex::encode_wire_frame(frame, f.op, status, f.id, f.tag, f.key,
+        status == vortex::wire_error ? std::string_view() : std::string_view(event.value));
+    vortex::send(socket, frame);
+}
+
+// evaluate the requests in one read; a partial last line (or frame) is
+// kept for the next read
+static void handle_input(int socket, std::string &request) {
+
+    cm_cache::cache cache(&processor);
+    cm_cache::cache_event req_event;
+
+    // responses to this input go out in one write when the handler returns
+    vortex::output_batch batch(socket);
+
+    // slice complete lines out of the buffer in place; a pipeline of
+    // requests costs no allocation per line
+    const char *p = request.data();
+    const char *end = p + request.size();
+
+    bool binary = protocols.binary(socket);
+    bool first = true;
+
+    while(p < end) {
+
+        // after the upgrade, everything is binary protocol frames
+        if(binary) {
+            vortex::wire_frame f;
+            size_t n = vortex::decode_wire_frame(p, end - p, f);
+            if(n == 0) break;
+            p += n;
+            dispatch_frame(socket, f, req_event);
+            continue;
+        }
+
+        // a replication frame from a peer; it holds binary data, so it is
+        // taken by its length rather than up to a newline
+        if((uint8_t) *p == vortex::frame_magic) {
+
+            // only our upstream and our peers replicate; from anyone else
+            // it would apply mutations under a forged origin
+            if(!replication_socket(socket)) {
+                cm_log::error(cm_util::format("%d: replication frame from a client, disconnecting", socket));
+                shutdown(socket, SHUT_RDWR);
+                p = end;
+                break;
+            }
+
+            // raw keys and values would not replay from a text journal; a
+            // server that replicates runs with the binary journal (see main)
+            if(journal.get_format() != vortex::journal_format::binary) {
+                cm_log::error(cm_util::format("%d: replication needs the binary journal, disconnecting", socket));
+                shutdown(socket, SHUT_RDWR);
+                p = end;
+                break;
+            }
+
+            vortex::origin from;
+            vortex::record_view rec;
+            bool corrupt;
+            size_t n = vortex::decode_frame(p, end - p, from, rec, corrupt);
+            if(corrupt) {
+                cm_log::error(cm_util::format("%d: corrupt replication frame, disconnecting", socket));
+                shutdown(socket, SHUT_RDWR);
+                p = end;
+                break;
+            }
+            if(n == 0) break;
+            p += n;
+            apply_frame(socket, from, rec, req_event);
+            continue;
+        }
+
+        const char *nl = (const char *) memchr(p, '\n', end - p);
+        if(nullptr == nl) break;
+
+        std::string_view item(p, nl - p + 1);
+        p = nl + 1;
+
+        // a peer answers the hello with its first line; a socket cannot
+        // make itself a peer later on
+        bool hello_reply = first && protocols.take_fresh(socket);
+        first = false;
+
+        // replication control lines
+        if(item.compare(0, 2, "$:") == 0) {
+            if(item.compare(0, 15, "$:VORTEX_CLIENT") == 0 && !hello_reply) {
+                cm_log::warning(cm_util::format("%d: peer handshake after the hello reply, ignored", socket));
+                continue;
+            }
+            if(item == "$:VORTEX_CLIENT\n") {
+                vortex::replication.add_peer(socket);
+                cm_log::info(cm_util::format("%d: vortex to vortex established", socket));
+                continue;
+            }
+            if(item.compare(0, 16, "$:VORTEX_CLIENT ") == 0) {
+                // a reconnecting peer catches up from its last applied seq
+                char *next;
+                uint64_t seq = strtoull(item.data() + 16, &next, 10);
+                uint64_t epoch = strtoull(next, NULL, 10);
+                vortex::replication.add_peer(socket, true, seq, epoch);
+                cm_log::info(cm_util::format("%d: vortex to vortex established", socket));
+                continue;
+            }
+            if(item == "$:BINARY\n") {
+                // raw keys and values would not replay from a text
+                // journal; the client stays on the text protocol
+                if(journal.get_format() != vortex::journal_format::binary) {
+                    vortex::send(socket, "$:TEXT\n", 7);
+                    cm_log::warning(cm_util::format("%d: binary protocol refused: text journal", socket));
+                    continue;
+                }
+
+                // the client answered the hello with an upgrade; the
+                // rest of its input is frames
+                protocols.set_binary(socket);
+                binary = true;
+                vortex::send(socket, "$:BINARY\n", 9);
+                cm_log::info(cm_util::format("%d: binary protocol", socket));
+                continue;
+            }
+            // resync markers come only from our upstream; from anyone else
+            // they would sweep the store and rewrite our resume position
+            if((item == "$:RESYNC\n" || item.compare(0, 7, "$:REPL ") == 0) &&
+                    (nullptr == client || client->get_socket() != socket)) {
+                cm_log::warning(cm_util::format("%d: replication marker from a client, ignored", socket));
+                continue;
+            }
+            if(item == "$:RESYNC\n") {
+                // a full copy of the upstream store follows
+                sweep.begin();
+                cm_log::info(cm_util::format("%d: replication resync from the upstream store", socket));
+                continue;
+            }
+            if(item.compare(0, 7, "$:REPL ") == 0) {
+                // the batch before this marker is applied; acknowledge it
+                char *next;
+                uint64_t seq = strtoull(item.data() + 7, &next, 10);
+                strtoull(next, &next, 10);
+                uint64_t epoch = strtoull(next, NULL, 10);
+                size_t removed = sweep.end();
+                if(removed > 0) {
+                    cm_log::info(cm_util::format("%d: replication resync removed %lu keys not upstream",
+                        socket, removed));
+                }
+                upstream_epoch = epoch;
+                upstream_seq = seq;
+                vortex::send(socket, cm_util::format("$:ACK %llu\n", (unsigned long long) seq));
+                continue;
+            }
+            if(item.compare(0, 6, "$:ACK ") == 0) {
+                vortex::replication.ack(socket, strtoull(item.data() + 6, NULL, 10));
+                continue;
+            }
+        }
+
+        req_event.clear();
+        req_event.fd = socket;
+        // assign event.request; reuses its capacity from the last line
+        req_event.request.assign(item.data(), item.size());
+
+        // "+key value ~secs" sets key to expire secs from now
+        uint64_t ttl;
+        if(item[0] == '+' && vortex::parse_ttl(req_event.request, ttl)) {
+            request_expires = vortex::expiry_clock() + ttl * 1000;
+        }
+        cache.eval(req_event.request, req_event);
+        request_expires = 0;
+    }
+
+    // keep the partial last line (or frame) for the next read
+    if(p < end) {
+        if((size_t) (end - p) > max_request_size) {
+            // dropping part of a request would leave the rest of it to be
+            // parsed as the next one; a frame stream could never recover
+            cm_log::error(cm_util::format("%d: request exceeds %lu bytes, disconnecting",
+                socket, max_request_size));
+            shutdown(socket, SHUT_RDWR);
+        }
+        else {
+            inputs.put(socket, p, end - p);
+        }
+    }
+}
+
+// a client's last request may come without its newline; evaluate it
+// when the client disconnects, as if the newline had been sent
+static void finish_input(int socket, std::string &request) {
+
+    inputs.take(socket, request);
+    if(request.empty() || protocols.binary(socket)) return;
+
+    // a partial replication frame is never complete
+    if((uint8_t) request[0] == vortex::frame_magic) return;
+
+    if(request.back() != '\n') request.push_back('\n');
+    handle_input(socket, request);
+}
+
+void handle_event(cm_net::input_event *event) {
+
     std::string request = std::move(event->msg);
     int socket = event->fd;
     bool eof = event->eof;
@@ -643,7 +1373,8 @@ void request_handler(void *arg) {
     if(event->connect) {
         // send $:VORTEX
         std::string hello("$:VORTEX\n");
-        cm_net::send(socket, hello);
+        protocols.set_fresh(socket);
+        vortex::send(socket, hello);
         CM_LOG_TRACE {
             cm_log::info(cm_util::format("%d: sent hello:", socket));
             cm_log::hex_dump(cm_log::level::info, hello.c_str(), hello.size(), 16);
@@ -653,16 +1384,23 @@ void request_handler(void *arg) {
 
     // if this in an EOF event (client disconnected)
     if(event->eof) {
+        finish_input(socket, request);
+
+        // drop anything left of its input and unsent output
+        inputs.remove(socket);
+        protocols.remove(socket);
+        vortex::backlog.remove(socket);
+
         // remove socket from all watchers
         int num = watchers.remove(socket);
         if(num > 0) {
             CM_LOG_TRACE { cm_log::info(cm_util::format("%d: socket removed from %d watcher(s)", socket, num)); }
         }
 
-        if(echo_fd == socket) {
-            echo_fd = -1;
-            cm_log::warning(cm_util::format("%d: vortex to vortex discontinued", socket));
-        }
+        vortex::replication.remove_peer(socket);
+
+        // a reactor's socket closes only now, with nothing left of it
+        vortex::reactor::release(socket);
 
         return;
     }
@@ -672,52 +1410,133 @@ void request_handler(void *arg) {
         cm_log::hex_dump(cm_log::level::trace, request.c_str(), request.size(), 16);
     }
 
-    if(echo_fd == -1 && request == "$:VORTEX_CLIENT\n") {
-        echo_fd = socket;
-        cm_log::info(cm_util::format("%d: vortex to vortex established", socket));
-        return;
+    // a line split across reads continues here
+    inputs.take(socket, request);
+
+    handle_input(socket, request);
+}
+
+// expire name if it still has the expiry its timer was set for; called
+// by the expiry thread. watchers are told as for a removal, with no value
+bool expire_key(const std::string &name, uint64_t expires) {
+
+    {
+        // remove first: a key written again since keeps its new value, and
+        // nothing is journaled for it
+        vortex::mutation_guard guard;
+        if(vortex::mem_store->remove_expired(name, expires) == 0) return false;
+
+        // queued without waiting for a sync: under -f batch the expiry
+        // thread would otherwise run at the disk's fsync rate
+        journal.post('-', name, "-" + name + "\n");
     }
 
+    CM_LOG_TRACE { cm_log::trace(cm_util::format("expired: %s", name.c_str())); }
+
+    cm_cache::cache_event event;
+    event.fd = -1;
+    watchers.notify(name, std::string(), event);
+    return true;
+}
+
+// apply a publish request. it runs after the triggering request was
+// answered, so its result is not sent: a late OK:key2 line would land in
+// that client's pipeline, or on another client once the fd is reused
+void publish_eval(vortex::publish_request &r) {
     cm_cache::cache cache(&processor);
     cm_cache::cache_event req_event;
+    req_event.fd = -1;
+    req_event.request.assign(r.request);
+    cache.eval(r.request, req_event);
+}
 
-    std::stringstream ss(request);
-    std::string item;
+void request_dealloc(void *arg) {
+    delete (cm_net::input_event *) arg;
+}
 
-    while (std::getline (ss, item, '\n')) {
-        item.append("\n");
-        req_event.clear();
-        req_event.fd = socket;
-        // look for fingerprints in request. if found,
-        // remove from request and put them in event.fingerprints
-        // if our own fingerprint is in the list, ignore the request
-        if(filter_fingerprints(item, req_event)) {
-            cache.eval(req_event.request, req_event);
-        }
+// set by SIGUSR1: log the publish route report on the next tick
+static volatile sig_atomic_t report_routes = 0;
+
+void request_route_report(int sig) {
+    report_routes = 1;
+}
+
+void log_routes() {
+    std::vector<std::string> routes;
+    watchers.routes(routes);
+    cm_log::info(cm_util::format("publish routes: %lu", routes.size()));
+    for(auto &route : routes) {
+        cm_log::info(route);
     }
+}
 
-    // process any publish requests generated in notify
-    // by this incoming request...
+void log_publish_stats() {
+    vortex::publish_stats st;
+    vortex::publisher.stats(st);
+    if(st.processed == 0 && st.dropped == 0 && st.depth == 0) return;
+    cm_log::info(cm_util::format("publish: %llu applied, avg %llu us, max %llu us, %llu over hop limit, depth %lu",
+        (unsigned long long) st.processed,
+        (unsigned long long) (st.processed > 0 ? st.total_us / st.processed : 0),
+        (unsigned long long) st.max_us, (unsigned long long) st.dropped, st.depth));
+}
 
-    while(pub_queue.size() > 0) {
-         item = pub_queue.pop_front();
-         req_event.clear();
-         req_event.fd = socket;
-         req_event.request.assign(item);
-         cache.eval(item, req_event);
+void log_scheduler_stats() {
+    std::vector<vortex::worker_stats> stats;
+    vortex::tasks.stats(stats);
+    for(size_t n = 0; n < stats.size(); n++) {
+        vortex::worker_stats &st = stats[n];
+        cm_log::info(cm_util::format("worker %lu: depth %lu, executed %llu, stolen %llu, busy %llu ms",
+            n, st.depth, (unsigned long long) st.executed, (unsigned long long) st.stolen,
+            (unsigned long long) (st.busy_us / 1000)));
+    }
+}
 
-         if(pub_queue.size() > 0) {
-             timespec delay = {0, 10000000};   // 10 ms
-             nanosleep(&delay, NULL);  
-         } 
+void log_replication_stats() {
+    std::vector<vortex::peer_stats> stats;
+    vortex::replication.stats(stats);
+    for(auto &st : stats) {
+        cm_log::info(cm_util::format("%d: replication: sent %llu, acked %llu, lag %llu (%llu ms)%s",
+            st.fd, (unsigned long long) st.sent_seq, (unsigned long long) st.acked_seq,
+            (unsigned long long) st.lag_seq, (unsigned long long) st.lag_ms,
+            st.syncing ? ", resyncing" : ""));
+    }
+    if(upstream_seq > 0) {
+        cm_log::info(cm_util::format("replication: applied upstream seq %llu",
+            (unsigned long long) upstream_seq.load()));
     }
 }
 
-void request_dealloc(void *arg) {
-    delete (cm_net::input_event *) arg;
+void log_expiry_stats() {
+    vortex::expiry_stats stats;
+    vortex::expiry.stats(stats);
+    if(stats.pending == 0 && stats.expired == 0) return;
+    cm_log::info(cm_util::format("expiry: %lu keys pending, %llu expired",
+        stats.pending, (unsigned long long) stats.expired));
+}
+
+void log_eviction_stats() {
+    vortex::eviction_stats stats;
+    vortex::eviction.stats(stats);
+    if(stats.budget == 0) return;
+    cm_log::info(cm_util::format("eviction: %lu of %lu bytes resident, %llu evicted (%llu bytes)",
+        stats.resident, stats.budget, (unsigned long long) stats.evicted,
+        (unsigned long long) stats.evicted_bytes));
+}
+
+// subscribers that are backed up or have lost notifications
+void log_output_stats() {
+    std::vector<vortex::output_stats> stats;
+    vortex::backlog.stats(stats);
+    for(auto &st : stats) {
+        if(st.depth == 0 && st.dropped == 0 && st.conflated == 0) continue;
+        cm_log::info(cm_util::format("%d: output: depth %lu (%lu notifications), sent %llu, dropped %llu, conflated %llu",
+            st.fd, st.depth, st.notifications, (unsigned long long) st.sent,
+            (unsigned long long) st.dropped, (unsigned long long) st.conflated));
+    }
 }
 
-void vortex::run(int port, const std::string &host_name, int _host_port, const std::string &_instance_name) {
+void vortex::run(int port, const std::string &host_name, int _host_port, const std::string &_instance_name,
+    int num_reactors, bool pin_reactors) {
 
     instance_name = _instance_name;
     if(instance_name == "vortex") {
@@ -725,9 +1544,10 @@ void vortex::run(int port, const std::string &host_name, int _host_port, const s
         instance_name = cm_util::format("%s_%d",
          _instance_name.c_str(), n);
     }
-    instance_fingerprint = std::string("%%")+instance_name;
+    instance = vortex::instance_id(instance_name);
+    vortex::replication.set_instance(instance);
 
-    cm_log::info(cm_util::format("instance name: %s", instance_name.c_str()));
+    cm_log::info(cm_util::format("instance name: %s (id %08x)", instance_name.c_str(), instance));
 
     if(_host_port != -1) {
         host_port = _host_port;
@@ -736,22 +1556,75 @@ void vortex::run(int port, const std::string &host_name, int _host_port, const s
 
     connected = false;
     time_t next_connect_time = 0;
+    time_t next_stats_time = cm_time::clock_seconds() + 60;
+
+    // kill -USR1 logs the publish routes
+    signal(SIGUSR1, request_route_report);
+
+    // publish requests from watch notifications run on their own stage
+    vortex::publisher.start(publish_eval);
+
+    // keys with a ttl expire on their own thread
+    vortex::expiry.start(expire_key);
+
+    // the listener's pool has one thread, which only hands events over in
+    // arrival order; the work is done by the scheduler if it was started,
+    // otherwise by a pool of workers
+    bool scheduled = vortex::tasks.started();
+    cm_thread::pool thread_pool(1);
+    std::unique_ptr<cm_thread::pool> worker_pool;
+    if(!scheduled) {
+        worker_pool.reset(new cm_thread::pool(6));
+        worker_pool_ptr = worker_pool.get();
+    }
 
-    // create thread pool that will do work for the server
-    cm_thread::pool thread_pool(6);
-    thread_pool_ptr = &thread_pool;
-
-    // startup tcp server
-    cm_net::pool_server server(port, &thread_pool, request_handler,
-        request_dealloc);
+    // startup tcp server: one pool_server listener feeding the pool, or
+    // reactors that each accept, read and handle requests on their own
+    // thread
+    std::unique_ptr<cm_net::pool_server> server;
+    std::vector<std::unique_ptr<vortex::reactor>> reactors;
+
+    if(num_reactors > 0) {
+        // a write waits for fdatasync under the batch policy; run on the
+        // reactor's thread, it would stall every connection of that
+        // reactor, so strands are handed to the workers instead
+        bool blocking = journal.get_sync() == vortex::journal_sync::batch;
+        int num_cpus = (int) std::max(std::thread::hardware_concurrency(), 1U);
+        for(int n = 0; n < num_reactors; n++) {
+            reactors.emplace_back(new vortex::reactor(n, port, blocking ? request_submit : request_handler,
+                request_dealloc, pin_reactors ? n % num_cpus : -1));
+            if(!reactors.back()->start()) {
+                cm_log::critical(cm_util::format("reactor %d: failed to start", n));
+                exit(1);
+            }
+        }
+    }
+    else {
+        server.reset(new cm_net::pool_server(port, &thread_pool, request_submit, request_dealloc));
+    }
 
-    while( !server.is_done() ) {
+    while(nullptr == server || !server->is_done()) {
     //while(1) {
         // timespec delay = {0, 100000000};   // 100 ms
         // nanosleep(&delay, NULL);
 
         _sleep(1000);
 
+        if(report_routes) {
+            report_routes = 0;
+            log_routes();
+        }
+
+        if(cm_time::clock_seconds() > next_stats_time) {
+            log_output_stats();
+            log_publish_stats();
+            log_scheduler_stats();
+            log_replication_stats();
+            log_eviction_stats();
+            log_expiry_stats();
+            next_stats_time = cm_time::clock_seconds() + 60;
+        }
+
         if(host_port != -1) {
 
             if(nullptr == client) {
@@ -783,4 +1656,5 @@ void vortex::run(int port, const std::string &host_name, int _host_port, const s
 
     // wait for pool_server threads to complete all work tasks
     thread_pool.wait_all();
+    if(worker_pool) worker_pool->wait_all();
 }
@@ -31,15 +31,34 @@
 #define __SERVER_H
 
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <set>
 #include <map>
+#include <deque>
+#include <functional>
+#include <tuple>
+#include <memory>
+#include <atomic>
+#include <string_view>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
 
 #include "log.h"
 #include "network.h"
 #include "storage.h"
 #include "cache.h"
 #include "queue.h"
+#include "output.h"
+#include "radix_tree.h"
+#include "publish.h"
+#include "reactor.h"
+#include "scheduler.h"
+#include "replication.h"
+#include "protocol.h"
+#include "evictor.h"
+#include "expiry.h"
 
 
 namespace vortex {
@@ -90,7 +109,10 @@ public:
 };
 
 
-void run(int port, const std::string &host_name, int _host_port, const std::string &instance_name);
+// num_reactors > 0 serves clients from that many SO_REUSEPORT event loops,
+// optionally pinned one per cpu, instead of a single listener
+void run(int port, const std::string &host_name, int _host_port, const std::string &instance_name,
+    int num_reactors = 0, bool pin_reactors = false);
 
 }
 
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <thread>
+#include <time.h>
+
+#include "shard_store.h"
+
+vortex::shard_store *vortex::mem_store = new vortex::shard_store();
+
+void vortex::init_store(size_t num_shards) {
+    delete mem_store;
+    mem_store = new shard_store(num_shards);
+}
+
+// lfu counters start here so new keys are not evicted before they are read
+static const uint8_t lfu_init = 5;
+
+// lfu counters lose one per minute without access
+static const uint32_t lfu_decay_ticks = 600;
+
+uint32_t vortex::access_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t) (ts.tv_sec * 10 + ts.tv_nsec / 100000000);
+}
+
+uint64_t vortex::expiry_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t xorshift() {
+    static thread_local uint32_t x = 2463534242U ^ (uint32_t) (uintptr_t) &x;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// access counter after the time since its last access
+static uint8_t lfu_decayed(const vortex::entry &e, uint32_t now) {
+    uint32_t periods = (now - e.access) / lfu_decay_ticks;
+    return periods >= e.freq ? 0 : (uint8_t) (e.freq - periods);
+}
+
+// record an access: the counter grows ever more slowly (about log2 of
+// the hits), so it stays in 8 bits
+static void touch(vortex::entry &e) {
+    uint32_t now = vortex::access_clock();
+    uint8_t freq = lfu_decayed(e, now);
+    if(freq < 255) {
+        uint32_t base = freq > lfu_init ? freq - lfu_init : 0;
+        if(xorshift() % (base * 10 + 1) == 0) freq++;
+    }
+    e.freq = freq;
+    e.access = now;
+}
+
+vortex::shard_store::shard_store(size_t num_shards): _resident(0) {
+    set_shards(num_shards);
+}
+
+vortex::shard_store::~shard_store() {
+    for(auto s: _shards) delete s;
+    _shards.clear();
+}
+
+void vortex::shard_store::set_shards(size_t num_shards) {
+
+    if(num_shards == 0) {
+        // default: a few stripes per core
+        num_shards = std::thread::hardware_concurrency() * 4;
+        if(num_shards == 0) num_shards = 16;
+    }
+
+    size_t bits = 0;
+    while(((size_t) 1 << bits) < num_shards && bits < 16) bits++;
+
+    for(auto s: _shards) delete s;
+    _shards.clear();
+
+    _bits = bits;
+    for(size_t i = 0; i < ((size_t) 1 << bits); i++) {
+        _shards.push_back(new shard());
+    }
+}
+
+void vortex::shard::link(entry &e) {
+    entry *&head = _segments[e.segment];
+    e.prev = nullptr;
+    e.next = head;
+    if(head != nullptr) head->prev = &e;
+    head = &e;
+}
+
+void vortex::shard::unlink(entry &e) {
+    if(e.prev != nullptr) {
+        e.prev->next = e.next;
+    }
+    else {
+        auto it = _segments.find(e.segment);
+        if(it != _segments.end()) {
+            if(e.next != nullptr) it->second = e.next;
+            else _segments.erase(it);
+        }
+    }
+    if(e.next != nullptr) e.next->prev = e.prev;
+    e.prev = e.next = nullptr;
+}
+
+std::string vortex::shard_store::find(const std::string &name) {
+    shard &s = get_shard(name);
+    std::string value;
+    s.lock();
+    auto it = s._map.find(name);
+    if(it != s._map.end()) {
+        entry &e = it->second;
+        if(e.expires == 0 || e.expires > expiry_clock()) {
+            value = e.value;
+            touch(e);
+        }
+    }
+    s.unlock();
+    return value;
+}
+
+bool vortex::shard_store::set(const std::string &name, const std::string &value, uint32_t segment,
+    uint64_t expires, bool upstream) {
+    shard &s = get_shard(name);
+    s.lock();
+    auto it = s._map.find(name);
+    if(it != s._map.end()) {
+        entry &e = it->second;
+        sub_memory(s, e.value.size());
+        e.value = value;
+        if(e.segment != segment) {
+            s.unlink(e);
+            e.segment = segment;
+            s.link(e);
+        }
+        e.expires = expires;
+        e.upstream = upstream;
+        touch(e);
+        add_memory(s, value.size());
+    }
+    else {
+        it = s._map.emplace(name, entry()).first;
+        entry &e = it->second;
+        e.value = value;
+        e.segment = segment;
+        e.key = &it->first;
+        e.expires = expires;
+        e.upstream = upstream;
+        e.freq = lfu_init;
+        e.access = access_clock();
+        s.link(e);
+        add_memory(s, entry_size(name.size(), value.size()));
+    }
+    s.unlock();
+    return true;
+}
+
+size_t vortex::shard_store::remove(const std::string &name) {
+    shard &s = get_shard(name);
+    size_t num_erased = 0;
+    s.lock();
+    auto it = s._map.find(name);
+    if(it != s._map.end()) {
+        s.unlink(it->second);
+        sub_memory(s, entry_size(name.size(), it->second.value.size()));
+        s._map.erase(it);
+        num_erased = 1;
+    }
+    s.unlock();
+    return num_erased;
+}
+
+size_t vortex::shard_store::remove_expired(const std::string &name, uint64_t expires) {
+    shard &s = get_shard(name);
+    size_t num_erased = 0;
+    s.lock();
+    auto it = s._map.find(name);
+    if(it != s._map.end() && it->second.expires == expires) {
+        s.unlink(it->second);
+        sub_memory(s, entry_size(name.size(), it->second.value.size()));
+        s._map.erase(it);
+        num_erased = 1;
+    }
+    s.unlock();
+    return num_erased;
+}
+
+size_t vortex::shard_store::remove_upstream(const std::string &name) {
+    shard &s = get_shard(name);
+    size_t num_erased = 0;
+    s.lock();
+    auto it = s._map.find(name);
+    if(it != s._map.end() && it->second.upstream) {
+        s.unlink(it->second);
+        sub_memory(s, entry_size(name.size(), it->second.value.size()));
+        s._map.erase(it);
+        num_erased = 1;
+    }
+    s.unlock();
+    return num_erased;
+}
+
+size_t vortex::shard_store::evict_segment(uint32_t segment, std::vector<entry_node> &evicted,
+    size_t chunk) {
+    size_t num_evicted = 0;
+    for(auto sp: _shards) {
+        shard &s = *sp;
+        bool more = true;
+        while(more) {
+            s.lock();
+            size_t n = 0;
+            auto it = s._segments.find(segment);
+            while(it != s._segments.end() && n < chunk) {
+                entry &e = *it->second;
+                auto mit = s._map.find(*e.key);
+                s.unlink(e);
+                sub_memory(s, entry_size(mit->first.size(), e.value.size()));
+                evicted.push_back(s._map.extract(mit));
+                n++;
+                it = s._segments.find(segment);
+            }
+            more = it != s._segments.end();
+            s.unlock();
+            num_evicted += n;
+        }
+    }
+    return num_evicted;
+}
+
+bool vortex::shard_store::evict_sample(size_t index, size_t samples, eviction_policy policy,
+    std::string &victim, size_t &bytes) {
+
+    shard &s = *_shards[index];
+    uint32_t now = access_clock();
+    entry *worst = nullptr;
+    uint64_t worst_score = 0;
+
+    // higher is evicted first: idle time for lru; for lfu the lowest
+    // counter, then the longest idle
+    auto consider = [&](entry &e) {
+        uint64_t idle = now - e.access;
+        uint64_t score = policy == eviction_policy::lru ? idle :
+            ((uint64_t) (255 - lfu_decayed(e, now)) << 32) | idle;
+        if(worst == nullptr || score > worst_score) {
+            worst = &e;
+            worst_score = score;
+        }
+    };
+
+    s.lock();
+    size_t buckets = s._map.bucket_count();
+    if(s._map.size() <= samples) {
+        for(auto &it : s._map) consider(it.second);
+    }
+    else {
+        // random buckets until enough entries were seen
+        size_t seen = 0;
+        for(size_t tries = 0; seen < samples && tries < samples * 8; tries++) {
+            size_t b = xorshift() % buckets;
+            for(auto it = s._map.begin(b); it != s._map.end(b); it++) {
+                consider(it->second);
+                seen++;
+            }
+        }
+    }
+    bool found = worst != nullptr;
+    if(found) {
+        victim = *worst->key;
+        bytes = entry_size(victim.size(), worst->value.size());
+        s.unlink(*worst);
+        sub_memory(s, bytes);
+        s._map.erase(victim);
+    }
+    s.unlock();
+
+    return found;
+}
+
+size_t vortex::shard_store::size() {
+    size_t sz = 0;
+    for(size_t i = 0; i < _shards.size(); i++) sz += size(i);
+    return sz;
+}
+
+size_t vortex::shard_store::size(size_t index) {
+    shard &s = *_shards[index];
+    s.lock();
+    size_t sz = s._map.size();
+    s.unlock();
+    return sz;
+}
+
+size_t vortex::shard_store::memory(size_t index) {
+    shard &s = *_shards[index];
+    s.lock();
+    size_t sz = s._memory;
+    s.unlock();
+    return sz;
+}
+
+void vortex::shard_store::clear() {
+    for(auto sp: _shards) {
+        shard &s = *sp;
+        s.lock();
+        s._map.clear();
+        s._segments.clear();
+        sub_memory(s, s._memory);
+        s.unlock();
+    }
+}
+
+bool vortex::shard_store::clear(size_t chunk) {
+    size_t n = 0;
+    for(auto sp: _shards) {
+        shard &s = *sp;
+        s.lock();
+        while(!s._map.empty() && n < chunk) {
+            auto it = s._map.begin();
+            s.unlink(it->second);
+            sub_memory(s, entry_size(it->first.size(), it->second.value.size()));
+            s._map.erase(it);
+            n++;
+        }
+        bool more = !s._map.empty();
+        s.unlock();
+        if(more) return true;
+    }
+    return false;
+}
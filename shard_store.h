@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SHARD_STORE_H
+#define __SHARD_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#include "util.h"
+
+namespace vortex {
+
+// stored value; entries that were last written in the same journal segment
+// are linked together so rotation can find them without a full scan
+struct entry {
+    std::string value;
+    uint32_t segment = 0;               // journal segment of newest write
+    uint32_t access = 0;                // access_clock() of the last access
+    uint8_t freq = 0;                   // logarithmic access counter
+    bool upstream = false;              // last written by our upstream
+    uint64_t expires = 0;               // ms since epoch; 0 without a ttl
+    const std::string *key = nullptr;   // points at the map node's key
+    entry *prev = nullptr;
+    entry *next = nullptr;
+};
+
+typedef std::unordered_map<std::string,entry>::node_type entry_node;
+
+// bytes an entry holds beyond its key and value: the map node with its
+// link and cached hash
+const size_t entry_overhead = sizeof(std::pair<const std::string,entry>) + 2 * sizeof(void *);
+
+inline size_t entry_size(size_t key_len, size_t value_len) {
+    return key_len + value_len + entry_overhead;
+}
+
+// coarse clock for access times, in 100 ms ticks
+uint32_t access_clock();
+
+// coarse wall clock for expiry times, in ms since epoch
+uint64_t expiry_clock();
+
+// which entries a memory budget evicts first
+enum class eviction_policy { lru, lfu };
+
+// one lock stripe of the store: each shard has its own map, lock and counters
+struct alignas(64) shard: public cm::mutex {
+    std::unordered_map<std::string,entry> _map;
+    std::unordered_map<uint32_t,entry *> _segments;    // segment list heads
+    size_t _memory = 0;     // bytes held by entries (see entry_size)
+
+    void link(entry &e);
+    void unlink(entry &e);
+};
+
+class shard_store {
+
+protected:
+    std::vector<shard *> _shards;
+    size_t _bits = 0;
+    std::atomic<size_t> _resident;      // sum of the shards' _memory
+
+    void add_memory(shard &s, size_t bytes) { s._memory += bytes; _resident += bytes; }
+    void sub_memory(shard &s, size_t bytes) { s._memory -= bytes; _resident -= bytes; }
+
+    shard &get_shard(const std::string &name) {
+        // use the high bits of a mixed hash so shard selection does not
+        // correlate with the bucket selection inside each shard's map
+        size_t h = std::hash<std::string>()(name);
+        uint64_t x = (uint64_t) h * 0x9E3779B97F4A7C15ULL;
+        return *_shards[_bits == 0 ? 0 : (size_t) (x >> (64 - _bits))];
+    }
+
+public:
+    shard_store(size_t num_shards = 0);
+    ~shard_store();
+
+    // set number of shards (rounded up to a power of two); only valid
+    // at startup while the store is still empty
+    void set_shards(size_t num_shards);
+    size_t shards() { return _shards.size(); }
+
+    // a key past its expiry is not found, even before it is removed
+    std::string find(const std::string &name);
+    // upstream marks a write replicated from our upstream server
+    bool set(const std::string &name, const std::string &value, uint32_t segment = 0,
+        uint64_t expires = 0, bool upstream = false);
+    size_t remove(const std::string &name);
+
+    // remove name if its newest write came from our upstream; a key
+    // written here since is left alone
+    size_t remove_upstream(const std::string &name);
+
+    // remove name if its expiry is still expires; a key written again
+    // since is left alone
+    size_t remove_expired(const std::string &name, uint64_t expires);
+
+    // remove every key whose newest write is in segment; the shard lock is
+    // released every chunk entries so writers are not held off for long.
+    // evicted nodes are moved to evicted rather than freed under the lock
+    size_t evict_segment(uint32_t segment, std::vector<entry_node> &evicted,
+        size_t chunk = 4096);
+
+    // call f(key, entry) for every entry of one shard, under its lock
+    template<class F>
+    void visit(size_t index, F f) {
+        shard &s = *_shards[index];
+        s.lock();
+        for(auto &it : s._map) f(it.first, it.second);
+        s.unlock();
+    }
+
+    // remove the entry the policy would evict first among about samples
+    // entries of one shard, giving its key and entry_size; false if the
+    // shard is empty. it is removed under the same lock it was chosen
+    // under, so an entry written again meanwhile is never the one taken
+    bool evict_sample(size_t index, size_t samples, eviction_policy policy, std::string &victim,
+        size_t &bytes);
+
+    size_t size();
+    size_t memory() { return _resident.load(std::memory_order_relaxed); }
+    size_t size(size_t index);
+    size_t memory(size_t index);
+
+    void clear();
+
+    // free up to chunk entries; returns true while entries remain
+    bool clear(size_t chunk);
+};
+
+// the live store; it is only replaced by init_store() at startup, before
+// any request or background thread can see it
+extern shard_store *mem_store;
+
+// replace the (empty) startup store with one of num_shards shards
+void init_store(size_t num_shards);
+
+}
+
+#endif  // __SHARD_STORE_H
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "storage.h"
+#include "snapshot.h"
+#include "record.h"
+#include "expiry.h"
+
+extern vortex::journal_logger journal;
+
+namespace {
+
+const char snapshot_magic[6] = { 'V', 'X', 'S', 'N', 'A', 'P' };
+const uint8_t snapshot_version = 3;
+const size_t snapshot_header_size = 16;
+const size_t snapshot_trailer_size = 16;
+
+void put32(std::string &out, uint32_t v) {
+    for(int i = 0; i < 4; i++) out.push_back((char) (v >> (8 * i)));
+}
+
+void put64(std::string &out, uint64_t v) {
+    for(int i = 0; i < 8; i++) out.push_back((char) (v >> (8 * i)));
+}
+
+uint32_t get32(const char *p) {
+    uint32_t v = 0;
+    for(int i = 3; i >= 0; i--) v = (v << 8) | (uint8_t) p[i];
+    return v;
+}
+
+uint64_t get64(const char *p) {
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = (v << 8) | (uint8_t) p[i];
+    return v;
+}
+
+bool write_all(int fd, const std::string &buf, uint32_t &crc) {
+    const char *p = buf.c_str();
+    size_t sz = buf.size();
+    crc = vortex::crc32(p, sz, crc);
+    while(sz > 0) {
+        ssize_t n = ::write(fd, p, sz);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        sz -= n;
+    }
+    return true;
+}
+
+// snapshot file names, newest first
+void scan_snapshots(std::vector<std::string> &matches) {
+    cm_util::dir_scan("./journal", R"(snapshot_[0-9]+\.snap$)", matches);
+    std::sort(matches.rbegin(), matches.rend());
+}
+
+}
+
+bool vortex::write_snapshot() {
+
+    if(journal.get_format() != journal_format::binary) {
+        cm_log::warning("snapshot: requires binary journal format, skipped");
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // every mutation that may hold a sequence number up to seq is still
+    // inside its mutation_guard or already in the store; wait out the
+    // former so the copy below includes all of them. mutations after seq
+    // may or may not be copied; replaying them on restart is idempotent.
+    uint64_t seq = journal.get_sequence();
+    vortex::mutations.synchronize();
+
+    std::string tmp = "./journal/snapshot.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) {
+        cm_log::error(cm_util::format("snapshot: open: %s: %s", tmp.c_str(), strerror(errno)));
+        return false;
+    }
+
+    uint32_t crc = 0;
+    bool ok = true;
+    std::string buf;
+
+    buf.append(snapshot_magic, sizeof(snapshot_magic));
+    buf.push_back((char) snapshot_version);
+    buf.push_back('\0');
+    put64(buf, seq);
+
+    std::map<uint32_t,std::string> names = vortex::segment_names();
+    put32(buf, (uint32_t) names.size());
+    for(auto &it : names) {
+        uint64_t first = 0;
+        vortex::journal_first_seq(it.second, first);
+        put32(buf, it.first);
+        put64(buf, first);
+        put32(buf, (uint32_t) it.second.size());
+        buf.append(it.second);
+    }
+    ok = write_all(fd, buf, crc);
+
+    // copy one shard at a time; only that shard is locked while it is
+    // serialized, and the file write happens after it is released
+    uint64_t count = 0;
+    vortex::shard_store *store = vortex::mem_store;
+    for(size_t i = 0; ok && i < store->shards(); i++) {
+        buf.clear();
+        store->visit(i, [&buf, &count](const std::string &key, const vortex::entry &e) {
+            put32(buf, (uint32_t) key.size());
+            put32(buf, (uint32_t) e.value.size());
+            put32(buf, e.segment);
+            put64(buf, e.expires);
+            buf.append(key);
+            buf.append(e.value);
+            count++;
+        });
+        ok = write_all(fd, buf, crc);
+    }
+
+    if(ok) {
+        buf.clear();
+        put64(buf, count);
+        put32(buf, crc);
+        put32(buf, 0);
+        uint32_t unused = 0;
+        ok = write_all(fd, buf, unused) && fdatasync(fd) == 0;
+    }
+
+    size_t bytes = (size_t) lseek(fd, 0, SEEK_CUR);
+    close(fd);
+
+    std::string path = cm_util::format("./journal/snapshot_%020llu.snap", (unsigned long long) seq);
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        cm_log::error(cm_util::format("snapshot: %s: %s", path.c_str(), strerror(errno)));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // keep the previous snapshot as a fallback, drop older ones
+    std::vector<std::string> matches;
+    scan_snapshots(matches);
+    for(size_t i = 2; i < matches.size(); i++) {
+        unlink(("./journal/" + matches[i]).c_str());
+    }
+
+    long ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    cm_log::info(cm_util::format("snapshot: %s: %llu keys, %lu bytes in %ld ms",
+        path.c_str(), (unsigned long long) count, bytes, ms));
+    return true;
+}
+
+static bool load_snapshot_file(const std::string &path,
+    const std::map<std::string,uint32_t> &segments, const std::map<uint64_t,uint32_t> &first_seqs,
+    uint64_t &seq) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t) (snapshot_header_size + 4 + snapshot_trailer_size)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t) st.st_size;
+    char *buf = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED) return false;
+    madvise(buf, size, MADV_SEQUENTIAL);
+
+    auto fail = [&](const char *why) {
+        cm_log::warning(cm_util::format("snapshot: %s: %s", path.c_str(), why));
+        munmap(buf, size);
+        return false;
+    };
+
+    if(memcmp(buf, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+        (uint8_t) buf[6] != snapshot_version) {
+        return fail("bad header");
+    }
+
+    const char *end = buf + size - snapshot_trailer_size;
+    if(vortex::crc32(buf, end - buf) != get32(end + 8)) {
+        return fail("checksum mismatch");
+    }
+    uint64_t count = get64(end);
+
+    seq = get64(buf + 8);
+    const char *p = buf + snapshot_header_size;
+
+    // map the snapshot's segment ids onto the segments loaded now
+    std::map<uint32_t,uint32_t> remap;
+    uint32_t num_segments = get32(p);
+    p += 4;
+    for(uint32_t i = 0; i < num_segments; i++) {
+        if((size_t) (end - p) < 16) return fail("truncated segment table");
+        uint32_t id = get32(p);
+        uint64_t first = get64(p + 4);
+        uint32_t len = get32(p + 12);
+        p += 16;
+        if((size_t) (end - p) < len) return fail("truncated segment table");
+
+        // the journal that was data.log may have been renamed since; its
+        // first record still identifies it
+        if(first > 0) {
+            auto it = first_seqs.find(first);
+            if(it != first_seqs.end()) remap[id] = it->second;
+        }
+        else {
+            auto it = segments.find(std::string(p, len));
+            if(it != segments.end()) remap[id] = it->second;
+        }
+        p += len;
+    }
+
+    vortex::shard_store *store = vortex::mem_store;
+    uint64_t now = vortex::expiry_clock();
+    uint64_t loaded = 0;
+    uint64_t dropped = 0;
+    for(uint64_t i = 0; i < count; i++) {
+        if((size_t) (end - p) < 20) return fail("truncated entry");
+        uint32_t key_len = get32(p);
+        uint32_t value_len = get32(p + 4);
+        uint32_t segment = get32(p + 8);
+        uint64_t expires = get64(p + 12);
+        p += 20;
+        if((uint64_t) (end - p) < (uint64_t) key_len + value_len) return fail("truncated entry");
+
+        // an entry whose journal has been dropped since would have been
+        // evicted by rotation, and one whose ttl has run out has expired
+        auto it = remap.find(segment);
+        if(it != remap.end() && (expires == 0 || expires > now)) {
+            std::string key(p, key_len);
+            store->set(key, std::string(p + key_len, value_len), it->second, expires);
+            if(expires > 0) vortex::expiry.schedule(key, expires);
+            loaded++;
+        }
+        else {
+            dropped++;
+        }
+        p += key_len + value_len;
+    }
+
+    munmap(buf, size);
+
+    cm_log::info(cm_util::format("snapshot: %s: seq %llu, %llu keys loaded, %llu retired",
+        path.c_str(), (unsigned long long) seq, (unsigned long long) loaded,
+        (unsigned long long) dropped));
+    return true;
+}
+
+bool vortex::load_snapshot(const std::map<std::string,uint32_t> &segments,
+    const std::map<uint64_t,uint32_t> &first_seqs, uint64_t &seq) {
+
+    std::vector<std::string> matches;
+    scan_snapshots(matches);
+
+    for(auto &name : matches) {
+        if(load_snapshot_file("./journal/" + name, segments, first_seqs, seq)) {
+            return true;
+        }
+        // a failed load may have applied part of the file
+        vortex::mem_store->clear();
+    }
+    return false;
+}
+
+void vortex::start_snapshots(int interval) {
+
+    if(interval <= 0) return;
+
+    std::thread([interval] {
+        for(;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(interval));
+            vortex::write_snapshot();
+        }
+    }).detach();
+}
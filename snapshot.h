@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2019, Tom Oleson <tom dot oleson at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * The names of its contributors may NOT be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace vortex {
+
+// point-in-time snapshot of the store
+//
+// snapshot_<seq>.snap files live next to the journals. seq is the last
+// journal sequence number the snapshot covers: every mutation with a
+// sequence number up to seq is in it, so a restart only replays journal
+// records after seq. layout (little endian):
+//
+//   header:   "VXSNAP" version(u8) reserved(u8) seq(u64)
+//   segments: count(u32), then id(u32) first_seq(u64) name_len(u32) name
+//             (the journal file each segment id refers to, by the sequence
+//             number of its first record, or 0 for an empty journal, and
+//             by name)
+//   entries:  key_len(u32) value_len(u32) segment(u32) expires(u64)
+//             key value ...  (expires: ms since epoch, 0 for no ttl)
+//   trailer:  entries(u64) crc32(u32) reserved(u32)
+//
+// the crc covers everything before the trailer. a snapshot is written to
+// a temporary file and renamed into place once it is complete and synced.
+
+// write a snapshot of the live store; only supported with binary journals,
+// whose records carry the sequence numbers a snapshot is positioned by
+bool write_snapshot();
+
+// load the newest valid snapshot into the live store. segments maps the
+// journal files present now to their segment ids, and first_seqs maps the
+// first sequence numbers of those that have records. a snapshot segment is
+// found by its first sequence number when it had one, since data.log may
+// have been rolled over and renamed since; otherwise by name. entries
+// whose journal has been dropped since are skipped. on success seq is the
+// snapshot's journal position
+bool load_snapshot(const std::map<std::string,uint32_t> &segments,
+    const std::map<uint64_t,uint32_t> &first_seqs, uint64_t &seq);
+
+// take a snapshot every interval seconds on a background thread
+void start_snapshots(int interval);
+
+}
+
+#endif  // __SNAPSHOT_H
@@ -27,15 +27,82 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "storage.h"
+#include "reclaimer.h"
+#include "record.h"
+#include "snapshot.h"
+#include "replication.h"
+#include "expiry.h"
 
 extern vortex::journal_logger journal;
 
+// last operation on each key within one journal. keys are spread over
+// buckets so that journals can be merged with one thread per bucket.
+struct journal_changes {
+
+    struct change {
+        std::string value;
+        uint64_t expires = 0;
+        bool removed = false;
+    };
+
+    std::vector<std::unordered_map<std::string,change>> buckets;
+    uint32_t segment = 0;
+    size_t records = 0;
+    size_t bytes = 0;
+    uint64_t max_seq = 0;
+    uint64_t after_seq = 0;
+    bool text = false;          // records carry no sequence numbers
+    long ms = 0;
+
+    journal_changes(size_t num_buckets): buckets(num_buckets) {}
+
+    change &get(std::string &&name) {
+        size_t b = std::hash<std::string>()(name) % buckets.size();
+        return buckets[b][std::move(name)];
+    }
+
+    void set(std::string name, std::string value, uint64_t expires = 0) {
+        change &c = get(std::move(name));
+        c.value = std::move(value);
+        c.expires = expires;
+        c.removed = false;
+        records++;
+    }
+
+    void remove(std::string name) {
+        change &c = get(std::move(name));
+        c.value.clear();
+        c.expires = 0;
+        c.removed = true;
+        records++;
+    }
+};
+
 class journal_processor: public cm_cache::scanner_processor {
 
+protected:
+    journal_changes *changes;
+    uint64_t expires = 0;       // of the line being evaluated
+
 public:
+    journal_processor(journal_changes *_changes): changes(_changes) {}
+
     bool do_add(const std::string &name, const std::string &value, cm_cache::cache_event &event) {
-        cm_store::mem_store.set(name, value);
+        changes->set(name, value, expires);
         return true;
     }
 
@@ -44,12 +111,12 @@ public:
     }
 
     bool do_read_remove(const std::string &name, cm_cache::cache_event &event) {
-        int num = cm_store::mem_store.remove(name);
+        changes->remove(name);
         return true;
     }
 
     bool do_remove(const std::string &name, cm_cache::cache_event &event) {
-        int num = cm_store::mem_store.remove(name);
+        changes->remove(name);
         return true;
     }
 
@@ -58,7 +125,7 @@ public:
     }
 
     bool do_watch_remove(const std::string &name, const std::string &tag, cm_cache::cache_event &event) {
-        int num = cm_store::mem_store.remove(name);
+        changes->remove(name);
         return true;
     }
 
@@ -69,11 +136,19 @@ public:
     bool do_input(const std::string &in_str, cm_cache::cache_event &event) { 
     
         //cm_log::info(cm_util::format("%s", in_str.c_str()));
+        expires = 0;
         if(in_str.size() > 2) {
             // seek space between timestamp and expr
             int pos = in_str.find(" ");
             if(pos > 1) {
                 event.request.assign( in_str.substr(pos + 1) );
+
+                // "+key value ~secs": ttl counted from the line's timestamp
+                uint64_t ttl;
+                if(vortex::parse_ttl(event.request, ttl)) {
+                    uint64_t millis = (uint64_t) (strtod(in_str.c_str(), nullptr) * 1000 + 0.5);
+                    expires = millis + ttl * 1000;
+                }
                 return true;
             }
             else {
@@ -91,12 +166,33 @@ public:
     }
 };
 
-void vortex::init_storage() {
+// journal segment stamped on new writes; each journal file is one segment
+static std::atomic<uint32_t> segment(1);
 
-    journal_processor processor;
-    cm_cache::cache cache(&processor);
+// rotated journal file name -> segment it holds
+static std::map<std::string,uint32_t> segment_files;
+static std::mutex segment_mutex;
 
-    std::vector<std::string> matches;
+vortex::rcu_domain vortex::mutations;
+
+uint32_t vortex::current_segment() {
+    return segment.load();
+}
+
+void vortex::advance_segment() {
+    segment.fetch_add(1);
+}
+
+std::map<uint32_t,std::string> vortex::segment_names() {
+    std::map<uint32_t,std::string> names;
+    std::lock_guard<std::mutex> guard(segment_mutex);
+    for(auto &it : segment_files) names[it.second] = it.first;
+    names[vortex::current_segment()] = "data.log";
+    return names;
+}
+
+// sorted journal file names, oldest first; the current journal is always last
+static void scan_journals(std::vector<std::string> &matches) {
 
     // scan ./journal directory and match any that end with ".log"
     // note: use of raw string literal to avoid need to escape \ in regex
@@ -105,112 +201,429 @@ void vortex::init_storage() {
     if(matches.size() > 1) {
         std::sort(matches.begin(), matches.end());
     }
-    
-    int count = 0;
-    for(auto name : matches) {
-        std::string path = "./journal/" + name;
-        // if not the current log file, add to rotation list
-        if(name != "data.log") {
-            journal.rotation_list_add(path);
-        }
-        count = cache.load(path);
-        cm_log::info(cm_util::format("%s: %d", name.c_str(), count ));
+
+    auto it = std::find(matches.begin(), matches.end(), "data.log");
+    if(it != matches.end()) {
+        matches.erase(it);
+        matches.push_back("data.log");
     }
-    cm_log::info(cm_util::format("journals: %d", matches.size()));
 }
 
+static bool is_binary_journal(const std::string &path) {
+    char buf[vortex::journal_header_size];
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) return false;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && vortex::is_journal_header(buf, (size_t) n);
+}
 
-cm_store::info_store<std::string,std::string> vortex::rotate_store;
+// sequence number of the first record in a binary journal
+static bool first_seq(const std::string &path, uint64_t &seq) {
+    char buf[vortex::journal_header_size + vortex::record_header_size];
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) return false;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n == (ssize_t) sizeof(buf) && vortex::is_journal_header(buf, (size_t) n) &&
+        vortex::peek_record_seq(buf + vortex::journal_header_size, vortex::record_header_size, seq);
+}
 
-class rotate_processor: public cm_cache::scanner_processor {
+// call f for the records of one binary journal in (after, upto]; returns
+// false if the file cannot be read
+static bool read_binary(const std::string &path, uint64_t after, uint64_t upto,
+    const std::function<void(const vortex::record_view &)> &f) {
 
-public:
-    bool do_add(const std::string &name, const std::string &value, cm_cache::cache_event &event) {
-        vortex::rotate_store.set(name, value);
-        return true;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
     }
 
-    bool do_read(const std::string &name, cm_cache::cache_event &event) {
+    size_t size = (size_t) st.st_size;
+    if(size <= vortex::journal_header_size) {
+        close(fd);
         return true;
     }
 
-    bool do_read_remove(const std::string &name, cm_cache::cache_event &event) {
-        int num = cm_store::mem_store.remove(name);
-        return true;
+    char *buf = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED) return false;
+    madvise(buf, size, MADV_SEQUENTIAL);
+
+    // the current journal may end in a record still being written
+    vortex::record_view r;
+    size_t pos = vortex::journal_header_size;
+    while(pos < size) {
+        size_t n = vortex::decode_record(buf + pos, size - pos, r);
+        if(n == 0 || r.seq > upto) break;
+        if(r.seq > after) f(r);
+        pos += n;
     }
 
-    bool do_remove(const std::string &name, cm_cache::cache_event &event) {
-        int num = vortex::rotate_store.remove(name);
-        return true;
+    munmap(buf, size);
+    return true;
+}
+
+bool vortex::read_journal_tail(uint64_t after, uint64_t upto,
+    const std::function<void(const record_view &)> &f) {
+
+    std::vector<std::string> matches;
+    scan_journals(matches);
+
+    // newest journal starting at or before the first record wanted; every
+    // journal from there on must be binary
+    size_t start = matches.size();
+    for(size_t i = matches.size(); i-- > 0;) {
+        std::string path = "./journal/" + matches[i];
+        if(!is_binary_journal(path)) {
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && st.st_size == 0) continue;
+            return false;
+        }
+        uint64_t seq;
+        if(!first_seq(path, seq)) continue;     // no records yet
+        if(seq <= after + 1) {
+            start = i;
+            break;
+        }
+    }
+    if(start == matches.size()) return false;
+
+    // sequence numbers are contiguous; a gap means a journal rolled over
+    // between the directory scan and reading it
+    uint64_t last = after;
+    bool gap = false;
+    auto next = [&f, &last, &gap](const vortex::record_view &r) {
+        if(r.seq != last + 1) gap = true;
+        if(gap) return;
+        last = r.seq;
+        f(r);
+    };
+
+    for(size_t i = start; i < matches.size() && !gap; i++) {
+        if(!read_binary("./journal/" + matches[i], after, upto, next)) return false;
     }
+    return !gap && last == upto;
+}
 
-    bool do_watch(const std::string &name, const std::string &tag, cm_cache::cache_event &event) {
-        return true;
+// parse a binary journal without tokenizing; a torn tail on the current
+// journal is truncated so new appends follow the last good record
+static void parse_binary(const std::string &path, bool current, journal_changes &changes) {
+
+    int fd = open(path.c_str(), current ? O_RDWR : O_RDONLY);
+    if(fd == -1) {
+        cm_log::error(cm_util::format("%s: open: %s", path.c_str(), strerror(errno)));
+        return;
     }
 
-    bool do_watch_remove(const std::string &name, const std::string &tag, cm_cache::cache_event &event) {
-        int num = cm_store::mem_store.remove(name);
-        return true;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= (off_t) vortex::journal_header_size) {
+        close(fd);
+        return;
     }
 
-    bool do_result(cm_cache::cache_event &event) {
-        return true;
+    size_t size = (size_t) st.st_size;
+    char *buf = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(buf == MAP_FAILED) {
+        cm_log::error(cm_util::format("%s: mmap: %s", path.c_str(), strerror(errno)));
+        close(fd);
+        return;
     }
+    madvise(buf, size, MADV_SEQUENTIAL);
 
-    bool do_input(const std::string &in_str, cm_cache::cache_event &event) { 
-    
-        //cm_log::info(cm_util::format("%s", in_str.c_str()));
-        if(in_str.size() > 2) {
-            // seek space between timestamp and expr
-            int pos = in_str.find(" ");
-            if(pos > 1) {
-                event.request.assign( in_str.substr(pos + 1) );
-                return true;
+    vortex::record_view r;
+    size_t pos = vortex::journal_header_size;
+
+    while(pos < size) {
+        size_t n = vortex::decode_record(buf + pos, size - pos, r);
+        if(n == 0) break;
+
+        // records up to after_seq are already in the loaded snapshot
+        if(r.seq > changes.after_seq) {
+            if(r.op == '+') {
+                changes.set(std::string(r.key, r.key_len), std::string(r.value, r.value_len), r.expires);
             }
             else {
-                // raw input line with no timestamp
-                event.request.assign(in_str);
+                changes.remove(std::string(r.key, r.key_len));
             }
         }
-        return true;
+
+        if(r.seq > changes.max_seq) changes.max_seq = r.seq;
+        pos += n;
     }
 
-    bool do_error(const std::string &expr, const std::string &err, cm_cache::cache_event &event) {
-        event.result.assign(cm_util::format("error: %s", err.c_str(), expr.c_str()));
-        cm_log::error(event.result);
-        return false;
+    munmap(buf, size);
+
+    if(pos < size) {
+        cm_log::warning(cm_util::format("%s: torn record at offset %lu, %lu bytes ignored",
+            path.c_str(), pos, size - pos));
+        if(current && ftruncate(fd, (off_t) pos) != 0) {
+            cm_log::error(cm_util::format("%s: ftruncate: %s", path.c_str(), strerror(errno)));
+        }
     }
-};
 
+    close(fd);
+}
 
-void vortex::rotate_storage() {
+static void parse_journal(const std::string &path, bool current, journal_changes &changes) {
+
+    auto start = std::chrono::steady_clock::now();
+
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0) changes.bytes = (size_t) st.st_size;
+
+    if(is_binary_journal(path)) {
+        parse_binary(path, current, changes);
+    }
+    else {
+        changes.text = true;
+        journal_processor processor(&changes);
+        cm_cache::cache cache(&processor);
+        cache.load(path);
+    }
 
-    rotate_processor processor;
-    cm_cache::cache cache(&processor);
+    changes.ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+bool vortex::journal_first_seq(const std::string &name, uint64_t &seq) {
+    return first_seq("./journal/" + name, seq);
+}
+
+// apply one journal's changes to the live store, one thread per bucket
+static void merge_journal(journal_changes &changes) {
+
+    uint64_t now = vortex::expiry_clock();
+
+    std::vector<std::thread> threads;
+    for(auto &bucket : changes.buckets) {
+        threads.emplace_back([&bucket, &changes, now] {
+            vortex::shard_store *store = vortex::mem_store;
+            for(auto &it : bucket) {
+                // a key whose ttl ran out while we were down is as good as removed
+                if(it.second.removed || (it.second.expires > 0 && it.second.expires <= now)) {
+                    store->remove(it.first);
+                }
+                else {
+                    store->set(it.first, it.second.value, changes.segment, it.second.expires);
+                    if(it.second.expires > 0) vortex::expiry.schedule(it.first, it.second.expires);
+                }
+            }
+            // free the change set here too, in parallel
+            std::unordered_map<std::string,journal_changes::change>().swap(bucket);
+        });
+    }
+    for(auto &t : threads) t.join();
+}
+
+static std::string throughput(size_t records, size_t bytes, long ms) {
+    double secs = ms > 0 ? ms / 1000.0 : 0.001;
+    return cm_util::format("%lu records, %lu bytes in %ld ms (%.0f records/s, %.1f MB/s)",
+        records, bytes, ms, records / secs, bytes / secs / (1024.0 * 1024.0));
+}
+
+void vortex::init_storage() {
 
     std::vector<std::string> matches;
+    scan_journals(matches);
+
+    size_t num = matches.size();
+    size_t num_threads = std::max(std::thread::hardware_concurrency(), 2U);
+
+    // journal i holds segment i + 1; binary journals are also known by
+    // their first sequence number, which survives a rollover
+    std::map<std::string,uint32_t> segments;
+    std::map<uint64_t,uint32_t> first_seqs;
+    for(size_t i = 0; i < num; i++) {
+        segments[matches[i]] = (uint32_t) (i + 1);
+        uint64_t seq;
+        if(first_seq("./journal/" + matches[i], seq)) first_seqs[seq] = (uint32_t) (i + 1);
+    }
 
-    // scan ./journal directory and match any that end with ".log"
-    // note: use of raw string literal to avoid need to escape \ in regex
-    cm_util::dir_scan("./journal", R"(.+\.log$)", matches);
+    // start from the newest snapshot, if any; only journal records after
+    // its position need replaying. a journal followed by a binary journal
+    // that starts at or before that position is covered entirely.
+    uint64_t snapshot_seq = 0;
+    bool snapshot = vortex::load_snapshot(segments, first_seqs, snapshot_seq);
+
+    size_t first = 0;
+    if(snapshot) {
+        for(size_t i = num; i-- > 1;) {
+            uint64_t seq;
+            if(first_seq("./journal/" + matches[i], seq) && seq <= snapshot_seq + 1) {
+                first = i;
+                break;
+            }
+        }
+    }
 
-    if(matches.size() > 1) {
-        std::sort(matches.begin(), matches.end());
+    // journals are parsed concurrently into per-journal change sets and
+    // merged in file order, so the last writer wins and deletes are
+    // honored. parsing runs at most num_threads journals ahead of the merge
+    // to bound memory.
+
+    std::vector<std::unique_ptr<journal_changes>> results(num);
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t next = 0;
+    size_t merged = 0;
+
+    auto parser = [&] {
+        for(;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> guard(mutex);
+                cond.wait(guard, [&] { return next >= num || next < merged + num_threads; });
+                if(next >= num) return;
+                i = next++;
+            }
+
+            std::unique_ptr<journal_changes> changes(new journal_changes(num_threads));
+            changes->segment = (uint32_t) (i + 1);
+            changes->after_seq = snapshot_seq;
+            if(i >= first) {
+                parse_journal("./journal/" + matches[i], matches[i] == "data.log", *changes);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                results[i] = std::move(changes);
+            }
+            cond.notify_all();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> parsers;
+    for(size_t t = 0; t < std::min(num_threads, num); t++) {
+        parsers.emplace_back(parser);
     }
 
-    int count = 0;
-    for(auto name : matches) {
-        std::string path = "./journal/" + name;
-        count = cache.load(path);
-        cm_log::info(cm_util::format("rotate: %s: %d", name.c_str(), count ));
+    uint64_t max_seq = snapshot_seq;
+    size_t total_records = 0;
+    size_t total_bytes = 0;
+
+    for(size_t i = 0; i < num; i++) {
+        const std::string &name = matches[i];
+        uint32_t seg = (uint32_t) (i + 1);
+
+        std::unique_ptr<journal_changes> changes;
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            cond.wait(guard, [&] { return results[i] != nullptr; });
+            changes = std::move(results[i]);
+        }
+
+        // if not the current log file, add to rotation list
+        if(name != "data.log") {
+            journal.rotation_list_add("./journal/" + name);
+            std::lock_guard<std::mutex> guard(segment_mutex);
+            segment_files[name] = seg;
+        }
+
+        if(i < first) {
+            cm_log::info(cm_util::format("%s: covered by snapshot", name.c_str()));
+            std::lock_guard<std::mutex> guard(mutex);
+            merged++;
+            cond.notify_all();
+            continue;
+        }
+
+        merge_journal(*changes);
+
+        // text journals are numbered in replay order, continuing from the
+        // journals before them, so sequence numbers never go backwards
+        if(changes->text) max_seq += changes->records;
+        else max_seq = std::max(max_seq, changes->max_seq);
+        total_records += changes->records;
+        total_bytes += changes->bytes;
+        cm_log::info(cm_util::format("%s: %s", name.c_str(),
+            throughput(changes->records, changes->bytes, changes->ms).c_str()));
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            merged++;
+        }
+        cond.notify_all();
     }
 
-    journal.lock();
-    cm_store::mem_store.clear(); 
-    cm_store::mem_store.swap(vortex::rotate_store);
-    vortex::rotate_store.clear();
-    
-    journal.unlock();
+    for(auto &t : parsers) t.join();
+
+    journal.set_sequence(max_seq);
+    vortex::replication.set_sequence(max_seq);
+
+    // new writes go to data.log, which is the last segment loaded (or a
+    // new one if there was no data.log)
+    uint32_t seg = (uint32_t) num;
+    if(num == 0 || matches.back() != "data.log") seg++;
+    segment.store(seg);
+
+    long ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    cm_log::info(cm_util::format("journals: %d: %s", num,
+        throughput(total_records, total_bytes, ms).c_str()));
+
+    vortex::shard_store *store = vortex::mem_store;
+    cm_log::info(cm_util::format("store: %lu keys, %lu bytes, %lu shards",
+        store->size(), store->memory(), store->shards()));
+}
+
+void vortex::rotate_storage() {
+
+    std::vector<std::string> matches;
+    scan_journals(matches);
+
+    std::set<std::string> rotated;
+    for(auto &name : matches) {
+        if(name != "data.log") rotated.insert(name);
+    }
+
+    std::unique_lock<std::mutex> guard(segment_mutex);
+
+    // the journal that was just rolled over holds the segment before the
+    // one advance_segment() started
+    for(auto &name : rotated) {
+        if(segment_files.find(name) == segment_files.end()) {
+            segment_files[name] = vortex::current_segment() - 1;
+        }
+    }
+
+    // a journal the logger no longer keeps retires its segment: drop only
+    // the keys whose newest write is in it; anything written later lives
+    // on in a newer segment
+    std::vector<std::pair<std::string,uint32_t>> retired;
+    for(auto it = segment_files.begin(); it != segment_files.end();) {
+        if(rotated.find(it->first) == rotated.end()) {
+            retired.push_back(*it);
+            it = segment_files.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+
+    guard.unlock();
+
+    for(auto &r : retired) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<vortex::entry_node> evicted;
+        {
+            vortex::shard_store *store = vortex::mem_store;
+            store->evict_segment(r.second, evicted);
+        }
+        long ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        cm_log::info(cm_util::format("rotate: %s: segment %u: %lu keys unlinked in %ld ms",
+            r.first.c_str(), r.second, evicted.size(), ms));
+
+        // the evicted nodes are freed by the reclaimer, off this thread
+        vortex::store_reclaimer.retire(std::move(evicted));
+    }
 
-    cm_log::info(cm_util::format("rotated journals: %d", matches.size())); 
+    cm_log::info(cm_util::format("rotated journals: %d, retired: %d", rotated.size(), retired.size()));
 }
@@ -34,6 +34,11 @@
 #include "cache.h"
 #include "util.h"
 #include "logger.h"
+#include "shard_store.h"
+#include "rcu.h"
+#include "record.h"
+
+#include <functional>
 
 
 namespace vortex {
@@ -41,8 +46,37 @@ namespace vortex {
 void init_storage();
 void rotate_storage();
 
+// journal segment that new writes are stamped with
+uint32_t current_segment();
+
+// start a new segment; called as the journal is about to roll over
+void advance_segment();
+
+// journal file name of each live segment (the current one is data.log)
+std::map<uint32_t,std::string> segment_names();
+
+// sequence number of the first record in a binary journal under ./journal;
+// it stays with the journal when data.log is rolled over and renamed
+bool journal_first_seq(const std::string &name, uint64_t &seq);
+
+// call f for each binary journal record with after < seq <= upto, oldest
+// first. returns false without calling f when the retained journals do not
+// reach back to after + 1 (rotated away, or text journals), and false
+// after a partial run if a journal is dropped while it is being read
+bool read_journal_tail(uint64_t after, uint64_t upto,
+    const std::function<void(const record_view &)> &f);
+
+// writers hold a mutation_guard from journaling a change until the store
+// reflects it, so a snapshot can wait for every mutation up to a journal
+// position to land in the store
+extern rcu_domain mutations;
 
-extern cm_store::info_store<std::string,std::string> rotate_store;
+class mutation_guard {
+    int phase;
+public:
+    mutation_guard(): phase(mutations.read_lock()) {}
+    ~mutation_guard() { mutations.read_unlock(phase); }
+};
 
 }
 
@@ -40,6 +40,7 @@
 #include "log.h"
 #include "logger.h"
 #include "storage.h"
+#include "snapshot.h"
 #include "server.h"
 
 namespace vortex {